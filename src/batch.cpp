@@ -0,0 +1,263 @@
+#include "batch.hpp"
+
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include "parallel.hpp"
+#include "stipple.hpp"
+
+namespace {
+
+const char* const IMAGE_EXTENSIONS[] = {".png", ".jpg", ".jpeg", ".bmp",
+                                        ".gif", ".tga", ".pgm",  ".ppm",
+                                        ".pnm", ".psd", ".hdr"};
+
+std::string lowercase(std::string text) {
+    for (auto& c : text) c = std::tolower((unsigned char)c);
+    return text;
+}
+
+bool isImage(const std::string filename) {
+    const std::string name = lowercase(filename);
+    for (auto extension : IMAGE_EXTENSIONS)
+        if (hasExtension(name, extension)) return true;
+    return false;
+}
+
+bool isDirectory(const std::string path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+std::vector<std::string> listDirectory(const std::string directory) {
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) throw "Could not open the batch directory.\n";
+
+    std::vector<std::string> inputs;
+    while (struct dirent* entry = readdir(dir)) {
+        const std::string path = directory + "/" + entry->d_name;
+        if (isImage(entry->d_name) && !isDirectory(path))
+            inputs.push_back(path);
+    }
+    closedir(dir);
+
+    std::sort(inputs.begin(), inputs.end());
+    return inputs;
+}
+
+std::vector<std::string> expandGlob(const std::string pattern) {
+    glob_t matches;
+    std::vector<std::string> inputs;
+    if (glob(pattern.c_str(), 0, NULL, &matches) == 0)
+        for (std::size_t i = 0; i < matches.gl_pathc; ++i)
+            inputs.push_back(matches.gl_pathv[i]);
+    globfree(&matches);
+    return inputs;
+}
+
+std::vector<std::string> readList(std::istream& list) {
+    std::vector<std::string> inputs;
+    std::string line;
+    while (std::getline(list, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty()) inputs.push_back(line);
+    }
+    return inputs;
+}
+
+// `filename` without its directory and last extension.
+std::string stem(const std::string filename) {
+    const std::size_t slash = filename.find_last_of('/');
+    std::string name =
+        slash == std::string::npos ? filename : filename.substr(slash + 1);
+    const std::size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot) name.erase(dot);
+    return name;
+}
+
+std::string extension(const std::string filename) {
+    const std::size_t slash = filename.find_last_of('/');
+    const std::size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return "";
+    return filename.substr(dot);
+}
+
+struct Job {
+    std::string input;
+    std::size_t pixels;
+    // of the outputs, without their extension.
+    std::string name;
+};
+
+// Names the outputs of `jobs` after the stems of their inputs. Inputs that
+// share a stem (a.png and a.jpg, or x/a.png) would overwrite each other's
+// outputs and checkpoints, so the later ones get a -2, -3, ... suffix.
+void nameOutputs(std::vector<Job>& jobs, const std::string directory) {
+    std::set<std::string> taken;
+    for (auto& job : jobs) {
+        const std::string base = stem(job.input);
+        std::string name = base;
+        for (int suffix = 2; !taken.insert(name).second; ++suffix)
+            name = base + "-" + std::to_string(suffix);
+        if (name != base)
+            std::cerr << "WARNING: " << job.input << ": named " << name
+                      << ", its stem is already taken.\n";
+        job.name = directory + "/" + name;
+    }
+}
+
+// Totals of the jobs that succeeded, and the failed ones.
+struct Totals {
+    std::mutex mutex;
+    std::size_t images = 0, failed = 0, pixels = 0, generators = 0;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// One image failing, even out of memory, must not end the whole batch.
+void fail(Totals& totals, const Job& job, const std::string error) {
+    std::lock_guard<std::mutex> lock(totals.mutex);
+    ++totals.failed;
+    std::cerr << "ERROR: " << job.input << ": " << error;
+}
+
+void runOne(const Config& base, const Job& job, unsigned threads,
+            const std::function<unsigned()>& stepThreads,
+            StippleContext& context, Totals& totals) {
+    const std::string& name = job.name;
+
+    Config config = base;
+    config.setVerbose(false);
+    config.setThreads(threads);
+    config.setStepThreads(stepThreads);
+    config.setInFilename(job.input);
+    if (!base.getPointsFilename().empty())
+        config.setPointsFilename(name + ".stps");
+    if (!base.getCheckpointFilename().empty())
+        config.setCheckpointFilename(name + ".ckpt");
+    const std::string outExtension =
+        base.hasOutFilename() ? extension(base.getOutFilename()) : ".png";
+    const std::string outfile = name + (outExtension.empty() ? ".png"
+                                                              : outExtension);
+    // keeps the 'no image unless -o' rule of point sets.
+    if (base.hasOutFilename() || base.getPointsFilename().empty())
+        config.setOutFilename(outfile);
+
+    const Clock::time_point start = Clock::now();
+    try {
+        const JobResult result = runJob(config, &context);
+
+        std::lock_guard<std::mutex> lock(totals.mutex);
+        ++totals.images;
+        totals.pixels += (std::size_t)result.native.x * result.native.y;
+        totals.generators += result.generators;
+        std::cout << job.input << " -> "
+                  << (config.hasOutFilename() ? outfile
+                                              : config.getPointsFilename())
+                  << ": " << result.native.x << 'x' << result.native.y
+                  << ", " << result.generators << " points, " << std::fixed
+                  << std::setprecision(2) << secondsSince(start) << " s\n";
+    } catch (const char* error) {
+        fail(totals, job, error);
+    } catch (const std::exception& error) {
+        fail(totals, job, std::string(error.what()) + ".\n");
+    } catch (...) {
+        fail(totals, job, "unknown error.\n");
+    }
+}
+
+}  // namespace
+
+std::vector<std::string> batchInputs(const std::string source) {
+    if (source == "-") return readList(std::cin);
+    if (isDirectory(source)) return listDirectory(source);
+    if (source.find_first_of("*?[") != std::string::npos)
+        return expandGlob(source);
+
+    std::ifstream list(source);
+    if (!list) throw "Could not open the batch list.\n";
+    return readList(list);
+}
+
+std::size_t runBatch(const Config& config,
+                     const std::vector<std::string>& inputs) {
+    const std::string directory = config.getOutDirectory();
+    if (!isDirectory(directory) && mkdir(directory.c_str(), 0755) != 0)
+        throw "Could not create the output directory.\n";
+
+    const Clock::time_point start = Clock::now();
+    Totals totals;
+
+    std::vector<Job> jobs;
+    for (auto& input : inputs) {
+        std::size_t width, height;
+        if (!Image::probe(input, width, height)) {
+            ++totals.failed;
+            std::cerr << "ERROR: " << input << ": not a readable image.\n";
+            continue;
+        }
+        jobs.push_back({input, width * height, ""});
+    }
+    nameOutputs(jobs, directory);
+
+    // every job, large or small, runs on a worker of its own. Largest first,
+    // so that the last jobs to start are short ones.
+    std::stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+        return a.pixels > b.pixels;
+    });
+
+    // with fewer jobs than threads, the spare ones render and encode. Every
+    // step of a relaxation takes its share of the threads of the jobs still
+    // running, which only the nearest labelling and the centroids use: the
+    // large jobs that run last take over the threads of the finished ones.
+    const unsigned threads = config.getThreads();
+    const unsigned workers =
+        std::max<std::size_t>(1, std::min<std::size_t>(threads, jobs.size()));
+    const unsigned stageThreads = std::max(1u, threads / workers);
+    std::atomic<unsigned> running{0};
+    const std::function<unsigned()> stepThreads = [&]() {
+        return std::max(1u, threads / std::max(1u, running.load()));
+    };
+
+    std::vector<std::unique_ptr<StippleContext>> contexts(workers);
+    for (auto& context : contexts)
+        context = std::make_unique<StippleContext>();
+
+    parallelForWorker(jobs.size(), workers,
+                      [&](std::size_t i, unsigned worker) {
+                          ++running;
+                          runOne(config, jobs[i], stageThreads, stepThreads,
+                                 *contexts[worker], totals);
+                          --running;
+                      });
+
+    const double seconds = std::max(secondsSince(start), 1e-9);
+    std::cout << std::fixed << std::setprecision(2) << "BATCH: "
+              << totals.images << " images (" << totals.failed
+              << " failed), " << totals.pixels / 1e6 << " Mpx in " << seconds
+              << " s: " << totals.images / seconds << " images/s, "
+              << totals.pixels / 1e6 / seconds << " Mpx/s, "
+              << std::setprecision(0) << totals.generators / seconds
+              << " points/s\n";
+
+    return totals.failed;
+}
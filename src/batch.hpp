@@ -0,0 +1,28 @@
+#ifndef STIPPLING_BATCH_
+#define STIPPLING_BATCH_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "job.hpp"
+
+// Inputs of a batch: the images in `source` when it is a directory, the
+// matches of `source` when it is a glob pattern, else the lines of the list
+// file `source` ("-" for stdin).
+std::vector<std::string> batchInputs(const std::string source);
+
+// Stipples every one of `inputs` with the options of `config`, into its out
+// directory; each output is named after its input, with the extension of
+// the output file of `config` (.png by default) or .stps for point sets.
+// Inputs with the same name but for their directory or extension get a -2,
+// -3, ... suffix in input order.
+// The jobs run side by side on the threads of `config`, largest first; with
+// the nearest labelling, the jobs that run last label on the threads the
+// finished ones left.
+// Reports every job and the aggregate throughput on stdout, and returns
+// the number of failed jobs.
+std::size_t runBatch(const Config& config,
+                     const std::vector<std::string>& inputs);
+
+#endif  // STIPPLING_BATCH_
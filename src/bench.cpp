@@ -0,0 +1,253 @@
+// Benchmark of the whole stipple pipeline on synthetic inputs. Every
+// combination of instruction set, pattern, size, point count and iteration
+// count is run once, and the results are printed to stdout as JSON, so that
+// runs on different commits can be compared. Progress goes to stderr.
+
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "density.hpp"
+#include "image.hpp"
+#include "kernels.hpp"
+#include "memory.hpp"
+#include "render.hpp"
+#include "synthetic.hpp"
+#include "vector_export.hpp"
+#include "voronoi.hpp"
+
+#ifndef STIPPLE_COMMIT
+#define STIPPLE_COMMIT "unknown"
+#endif
+
+namespace {
+
+struct BenchConfig {
+    std::vector<CpuLevel> levels = {detectCpuLevel()};
+    std::vector<SyntheticPattern> patterns = {
+        SyntheticPattern::Circles, SyntheticPattern::Gradient,
+        SyntheticPattern::Checkerboard, SyntheticPattern::Noise};
+    std::vector<double> megapixels = {1, 4};
+    std::vector<std::size_t> points = {10000, 50000};
+    std::vector<std::size_t> iterations = {3};
+    unsigned threads = 1;
+    std::uint32_t seed = 420;
+};
+
+// Wall time of the phases of one run, in the order they ran.
+typedef std::vector<std::pair<const char*, double>> Phases;
+
+class Stopwatch {
+   private:
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+   public:
+    // seconds since the last lap (or construction).
+    double lap() {
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds =
+            std::chrono::duration<double>(now - start).count();
+        start = now;
+        return seconds;
+    }
+};
+
+// Runs the pipeline once and prints its JSON record; the peak RSS covers
+// this run only.
+void runCase(const BenchConfig& config, SyntheticPattern pattern,
+             double megapixels, std::size_t points, std::size_t iterations,
+             bool first) {
+    const std::size_t side =
+        std::max(1.0, std::round(std::sqrt(megapixels * 1e6)));
+    std::cerr << cpuLevelName(getCpuLevel()) << ' ' << syntheticName(pattern)
+              << ' ' << side << 'x' << side << ", "
+              << points << " points, " << iterations << " iterations\n";
+
+#ifdef __GLIBC__
+    // hand what the previous run freed back first.
+    malloc_trim(0);
+#endif
+    resetPeakRss();
+    Phases phases;
+    Stopwatch total, watch;
+
+    std::vector<Vector2> generators;
+    {
+        const Image img = syntheticImage(pattern, side, side, config.seed);
+        phases.push_back({"synthesize", watch.lap()});
+
+        const DensityMap density = DensityMap::from(img);
+        phases.push_back({"darkness", watch.lap()});
+
+        const std::pair<PrefixFunction, PrefixFunction> prefixFunctions =
+            density.computePrefixFunctions();
+        phases.push_back({"prefix", watch.lap()});
+
+        Random random(config.seed);
+        generators = rejectionSampling(points, density, random);
+        phases.push_back({"sampling", watch.lap()});
+
+        const Vector2 dimensions(side, side);
+        VoronoiScratch scratch;
+        double labelling = 0, centroids = 0;
+        for (std::size_t i = 0; i < iterations; ++i) {
+            getVoronoiBoundaries(dimensions, generators, scratch);
+            labelling += watch.lap();
+            generators =
+                computeVoronoiCenters(scratch.boundaries, prefixFunctions);
+            centroids += watch.lap();
+        }
+        phases.push_back({"labelling", labelling});
+        phases.push_back({"centroids", centroids});
+    }
+
+    const StippleStyle style{side, side, 1.5, 0xFF181818};
+    Image canvas(side, side);
+    canvas.fillByColor(WHITE);
+    renderStipples(generators, style, canvas, config.threads);
+    phases.push_back({"render", watch.lap()});
+
+    char filename[] = "/tmp/stipple-bench-XXXXXX";
+    const int fd = mkstemp(filename);
+    if (fd >= 0) {
+        close(fd);
+        canvas.saveAsPNG(filename, config.threads);
+        unlink(filename);
+    }
+    phases.push_back({"encode", watch.lap()});
+
+    const double seconds = total.lap();
+    double relaxation = 0;
+    for (auto& [name, time] : phases)
+        if (std::string(name) == "labelling" || std::string(name) == "centroids")
+            relaxation += time;
+    const double pixels = 1.0 * side * side * iterations;
+
+    std::cout << (first ? "" : ",\n") << "    {\"cpu\": \""
+              << cpuLevelName(getCpuLevel()) << "\", \"pattern\": \""
+              << syntheticName(pattern) << "\", \"width\": " << side
+              << ", \"height\": " << side << ", \"points\": " << points
+              << ", \"iterations\": " << iterations
+              << ", \"threads\": " << config.threads << ",\n     \"phases\": {";
+    for (std::size_t i = 0; i < phases.size(); ++i)
+        std::cout << (i ? ", " : "") << '"' << phases[i].first
+                  << "\": " << phases[i].second;
+    std::cout << "},\n     \"seconds\": " << seconds
+              << ", \"pixels_per_second\": "
+              << (relaxation > 0 ? pixels / relaxation : 0)
+              << ", \"points_per_second\": "
+              << (relaxation > 0 ? 1.0 * points * iterations / relaxation : 0)
+              << ", \"peak_rss_bytes\": " << peakRssBytes()
+              << ", \"generators\": " << generators.size() << '}';
+    std::cout.flush();
+}
+
+template <typename T, typename Parse>
+std::vector<T> parseList(const std::string list, Parse parse) {
+    std::vector<T> values;
+    std::size_t start = 0;
+    while (start <= list.size()) {
+        std::size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        values.push_back(parse(list.substr(start, end - start)));
+        start = end + 1;
+    }
+    return values;
+}
+
+void usage() {
+    std::cerr << "Usage: stipple-bench [options]\n"
+              << " --cpu        : instruction sets, e.g. scalar,avx2,avx512\n"
+              << " --patterns   : circles,gradient,checkerboard,noise\n"
+              << " --sizes      : megapixels of the inputs, e.g. 1,10,100\n"
+              << " --points     : generator point counts, e.g. 10000,100000\n"
+              << " --iterations : iteration counts, e.g. 1,10\n"
+              << " --threads    : threads rendering and encoding\n"
+              << " --seed       : seed of the sampling and the noise\n";
+}
+
+BenchConfig parseArguments(int argc, char** argv) {
+    BenchConfig config;
+    try {
+        for (int i = 1; i < argc; i += 2) {
+            const std::string argument = argv[i];
+            if (argument == "-h" || argument == "--help") {
+                usage();
+                exit(0);
+            }
+            if (i + 1 >= argc) throw 0;
+            const std::string value = argv[i + 1];
+
+            if (argument == "--cpu") {
+                config.levels = parseList<CpuLevel>(
+                    value, [](const std::string name) {
+                        CpuLevel level;
+                        if (!parseCpuLevel(name, level)) throw 0;
+                        if (level > detectCpuLevel()) throw 0;
+                        return level;
+                    });
+            } else if (argument == "--patterns") {
+                config.patterns = parseList<SyntheticPattern>(
+                    value, [](const std::string name) {
+                        SyntheticPattern pattern;
+                        if (!parseSyntheticPattern(name, pattern)) throw 0;
+                        return pattern;
+                    });
+            } else if (argument == "--sizes") {
+                config.megapixels = parseList<double>(
+                    value, [](const std::string x) { return std::stod(x); });
+            } else if (argument == "--points") {
+                config.points = parseList<std::size_t>(
+                    value, [](const std::string x) { return std::stoul(x); });
+            } else if (argument == "--iterations") {
+                config.iterations = parseList<std::size_t>(
+                    value, [](const std::string x) { return std::stoul(x); });
+            } else if (argument == "--threads") {
+                config.threads = std::max(1, std::stoi(value));
+            } else if (argument == "--seed") {
+                config.seed = std::stoul(value);
+            } else {
+                throw 0;
+            }
+        }
+    } catch (...) {
+        usage();
+        exit(1);
+    }
+    return config;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const BenchConfig config = parseArguments(argc, argv);
+
+    std::cout << "{\"commit\": \"" STIPPLE_COMMIT "\", \"runs\": [\n";
+    bool first = true;
+    for (auto level : config.levels) {
+        setCpuLevel(level);
+        for (auto pattern : config.patterns)
+            for (auto megapixels : config.megapixels)
+                for (auto points : config.points)
+                    for (auto iterations : config.iterations) {
+                        runCase(config, pattern, megapixels, points,
+                                iterations, first);
+                        first = false;
+                    }
+    }
+    std::cout << "\n]}\n";
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "cache.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+
+constexpr char MAGIC[4] = {'S', 'T', 'G', 'C'};
+constexpr std::uint32_t VERSION = 1;
+
+struct CacheHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t imageHash;
+    std::uint32_t points, seed, initMode, bandRows;
+    std::uint64_t count;
+};
+
+bool sameKey(const CacheHeader& header, const CacheKey& key) {
+    return header.imageHash == key.imageHash && header.points == key.points &&
+           header.seed == key.seed && header.initMode == key.initMode &&
+           header.bandRows == key.bandRows;
+}
+
+inline std::uint64_t mix(std::uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+}  // namespace
+
+std::string CacheKey::filename() const {
+    std::uint64_t h = imageHash;
+    for (std::uint32_t field : {points, seed, initMode, bandRows})
+        h = mix(h ^ field);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.gen", (unsigned long long)h);
+    return name;
+}
+
+GeneratorCache::GeneratorCache(const std::string directory)
+    : directory(directory) {}
+
+std::uint64_t GeneratorCache::hash(const void* data, std::size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    std::uint64_t h = mix(size ^ 0x9e3779b97f4a7c15ULL);
+
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        h = (h ^ mix(word)) * 0x100000001b3ULL;
+    }
+
+    std::uint64_t tail = 0;
+    std::memcpy(&tail, bytes + i, size - i);
+    return mix(h ^ mix(tail));
+}
+
+std::uint64_t GeneratorCache::hash(const DensityMap& density) {
+    std::uint64_t h =
+        hash(density.getData(),
+             density.getHeight() * density.getWidth() * sizeof(float));
+    return mix(h ^ (density.getWidth() << 32 | density.getHeight()));
+}
+
+std::uint64_t GeneratorCache::hash(const DomainMask& mask) {
+    // the number of runs of every row, then the runs.
+    std::vector<std::int32_t> runs;
+    for (std::size_t y = 0; y < mask.getHeight(); ++y) {
+        runs.push_back(mask.rowEnd(y) - mask.rowBegin(y));
+        for (auto run = mask.rowBegin(y); run != mask.rowEnd(y); ++run) {
+            runs.push_back(run->begin);
+            runs.push_back(run->end);
+        }
+    }
+    const std::uint64_t h =
+        hash(runs.data(), runs.size() * sizeof(std::int32_t));
+    return mix(h ^ (mask.getWidth() << 32 | mask.getHeight()));
+}
+
+bool GeneratorCache::load(const CacheKey& key,
+                          std::vector<Vector2>& generators) const {
+    int fd = open((directory + "/" + key.filename()).c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (std::size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    CacheHeader header;
+    std::memcpy(&header, mapped, sizeof(header));
+
+    // the count is bounded by the file size before it is multiplied, so a
+    // corrupt one cannot wrap around to the right size.
+    const std::size_t payload = st.st_size - sizeof(CacheHeader);
+    const std::size_t point = 2 * sizeof(std::int32_t);
+    bool valid = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                 header.version == VERSION && sameKey(header, key) &&
+                 header.count <= payload / point &&
+                 payload == header.count * point;
+
+    if (valid) {
+        const std::int32_t* coords =
+            (const std::int32_t*)((const char*)mapped + sizeof(CacheHeader));
+
+        generators.clear();
+        generators.reserve(header.count);
+        for (std::uint64_t i = 0; i < header.count; ++i)
+            generators.push_back(Vector2(coords[2 * i], coords[2 * i + 1]));
+    }
+
+    munmap(mapped, st.st_size);
+    return valid;
+}
+
+void GeneratorCache::store(const CacheKey& key,
+                           const std::vector<Vector2>& generators) const {
+    const std::string path = directory + "/" + key.filename();
+    // unique per thread, as several jobs may store the same key at once.
+    const std::string temporary =
+        path + ".tmp" +
+        std::to_string(
+            std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    mkdir(directory.c_str(), 0755);
+
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == NULL) {
+        std::cerr << "WARNING: could not write cache file: '" << temporary
+                  << "'.\n";
+        return;
+    }
+
+    CacheHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.imageHash = key.imageHash;
+    header.points = key.points;
+    header.seed = key.seed;
+    header.initMode = key.initMode;
+    header.bandRows = key.bandRows;
+    header.count = generators.size();
+
+    std::vector<std::int32_t> coords;
+    coords.reserve(2 * generators.size());
+    for (auto& generator : generators) {
+        coords.push_back(generator.x);
+        coords.push_back(generator.y);
+    }
+
+    bool written =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(coords.data(), sizeof(std::int32_t), coords.size(), file) ==
+            coords.size();
+    written = (fclose(file) == 0) && written;
+
+    // rename is atomic, so concurrent jobs never observe a partial file.
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "WARNING: could not write cache file: '" << path
+                  << "'.\n";
+        remove(temporary.c_str());
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef STIPPLING_CACHE_
+#define STIPPLING_CACHE_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Vector2.hpp"
+#include "density.hpp"
+
+// Everything the initial generator set depends on.
+struct CacheKey {
+    std::uint64_t imageHash;
+    std::uint32_t points, seed, initMode, bandRows;
+
+    std::string filename() const;
+};
+
+// Directory of initial generator sets, one compact binary file per CacheKey.
+class GeneratorCache {
+   private:
+    std::string directory;
+
+   public:
+    GeneratorCache(const std::string directory);
+
+    static std::uint64_t hash(const void* data, std::size_t size);
+    static std::uint64_t hash(const DensityMap& density);
+    static std::uint64_t hash(const DomainMask& mask);
+
+    // Returns false on a miss, or when the cached file is unusable.
+    bool load(const CacheKey& key, std::vector<Vector2>& generators) const;
+    void store(const CacheKey& key,
+               const std::vector<Vector2>& generators) const;
+};
+
+#endif  // STIPPLING_CACHE_
@@ -0,0 +1,311 @@
+// Unit checks of the parts the golden harness does not reach, because it
+// compares generators only: the png encoder is read back through stb_image
+// and compared pixel by pixel, and the dot blending of every instruction set
+// with the scalar one. Also the edge cases of single functions that its
+// synthetic images never hit.
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "density.hpp"
+#include "image.hpp"
+#include "kernels.hpp"
+#include "mask.hpp"
+#include "png.hpp"
+#include "pointset.hpp"
+#include "thirdparty/stb_image.h"
+#include "voronoi.hpp"
+
+namespace {
+
+std::string temporaryFile() {
+    char path[] = "/tmp/stipple-check-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) throw "Could not create a temporary file.\n";
+    close(fd);
+    return path;
+}
+
+// Returns an empty string when the check passes, else what went wrong.
+typedef std::function<std::string()> Check;
+
+// Fills a `width` x `height` image with a row `stride` of `pattern`.
+std::vector<Color> pngPixels(const std::string pattern, std::size_t width,
+                             std::size_t height, std::size_t stride) {
+    std::mt19937 rng(width * 31 + height);
+    std::vector<Color> pixels(stride * height, 0xDEADBEEF);
+    for (std::size_t y = 0; y < height; ++y)
+        for (std::size_t x = 0; x < width; ++x) {
+            Color& pixel = pixels[y * stride + x];
+            if (pattern == "noise")
+                pixel = rng();
+            else if (pattern == "flat")
+                pixel = 0xFF336699;
+            else if (pattern == "gradient")
+                pixel = 0xFF000000 | (x & 0xFF) | (y & 0xFF) << 8 |
+                        ((x + y) & 0xFF) << 16;
+            else  // dots: long runs of white, the output of a stipple.
+                pixel = rng() % 50 ? WHITE : 0xFF000000 | (rng() & 0xFF);
+        }
+    return pixels;
+}
+
+std::string pngRoundTrip(const std::string pattern, std::size_t width,
+                         std::size_t height, unsigned threads) {
+    const std::size_t stride = width + 3;
+    const std::vector<Color> pixels = pngPixels(pattern, width, height, stride);
+
+    const std::string filename = temporaryFile();
+    writePNG(filename, pixels.data(), width, height, stride, threads);
+    int w, h, components;
+    stbi_uc* decoded = stbi_load(filename.c_str(), &w, &h, &components, 4);
+    unlink(filename.c_str());
+
+    if (!decoded) return std::string("not decoded, ") + stbi_failure_reason();
+    std::string error;
+    if ((std::size_t)w != width || (std::size_t)h != height) {
+        error = "decoded as " + std::to_string(w) + "x" + std::to_string(h);
+    } else {
+        for (std::size_t y = 0; y < height && error.empty(); ++y)
+            if (std::memcmp(decoded + 4 * y * width, &pixels[y * stride],
+                            4 * width))
+                error = "row " + std::to_string(y) + " differs";
+    }
+    stbi_image_free(decoded);
+    return error;
+}
+
+// Blends `count` pixels from `offset` at the scalar level and at `level`,
+// and compares the whole rows.
+std::string blendRow(CpuLevel level, const std::vector<Color>& pixels,
+                     const std::vector<std::uint8_t>& coverage,
+                     std::size_t offset, std::size_t count, Color color) {
+    std::vector<Color> expected = pixels, actual = pixels;
+    setCpuLevel(CpuLevel::Scalar);
+    blendCoverage(&expected[offset], &coverage[offset], count, color);
+    setCpuLevel(level);
+    blendCoverage(&actual[offset], &coverage[offset], count, color);
+    for (std::size_t i = 0; i < pixels.size(); ++i)
+        if (actual[i] != expected[i]) {
+            char error[128];
+            std::snprintf(error, sizeof(error),
+                          "%08X under %u of %08X is %08X, not %08X",
+                          (unsigned)pixels[i], (unsigned)coverage[i],
+                          (unsigned)color, (unsigned)actual[i],
+                          (unsigned)expected[i]);
+            return error;
+        }
+    return "";
+}
+
+// Every destination, source and coverage value of each channel (the three
+// channels map them differently), then every row length up to a few vectors
+// at unaligned offsets, with pixels after the row that must stay untouched.
+std::string blendMatchesScalar(CpuLevel level) {
+    const CpuLevel initial = getCpuLevel();
+    std::mt19937 rng(level == CpuLevel::AVX2 ? 2 : 512);
+    std::string error;
+
+    std::vector<Color> pixels(256 * 256);
+    std::vector<std::uint8_t> coverage(pixels.size());
+    for (std::size_t i = 0; i < pixels.size(); ++i) {
+        const Color dst = i & 0xFF;
+        pixels[i] =
+            (rng() & 0xFF000000) | dst | (255 - dst) << 8 | (dst ^ 0x5A) << 16;
+        coverage[i] = i >> 8;
+    }
+    for (Color src = 0; src < 256 && error.empty(); ++src)
+        error = blendRow(level, pixels, coverage, 0, pixels.size(),
+                         0xFF000000 | src | ((src * 37 + 11) & 0xFF) << 8 |
+                             (255 - src) << 16);
+
+    for (std::size_t count = 1; count <= 67 && error.empty(); ++count)
+        for (std::size_t offset : {0, 1, 3}) {
+            std::vector<Color> row(offset + count + 16);
+            std::vector<std::uint8_t> rowCoverage(row.size());
+            for (std::size_t i = 0; i < row.size(); ++i) {
+                row[i] = rng();
+                rowCoverage[i] = rng() % 4 ? rng() & 0xFF : 0;
+            }
+            error = blendRow(level, row, rowCoverage, offset, count, rng());
+            if (!error.empty()) {
+                error = std::to_string(count) + " pixels from " +
+                        std::to_string(offset) + ": " + error;
+                break;
+            }
+        }
+
+    setCpuLevel(initial);
+    return error;
+}
+
+// Netpbm headers whose raster size does not fit, or wraps around to a few
+// bytes, are refused before a pixel is read.
+std::string oversizedNetpbm(const std::string header) {
+    const std::string filename = temporaryFile();
+    std::string error;
+    {
+        std::string bytes = header;
+        bytes.resize(64, '\0');
+        FILE* file = std::fopen(filename.c_str(), "wb");
+        if (!file) throw "Could not write a temporary file.\n";
+        std::fwrite(bytes.data(), 1, bytes.size(), file);
+        std::fclose(file);
+    }
+    try {
+        const NetpbmFile file(filename);
+        error = "read as " + std::to_string(file.getWidth()) + "x" +
+                std::to_string(file.getHeight());
+    } catch (const char*) {
+    }
+    unlink(filename.c_str());
+    return error;
+}
+
+// A run of the darkest pixels makes the prefix sums of the row so large
+// that the difference of two neighbours loses most of its bits: unclamped,
+// the centroid of a one pixel cell lands pixels away from it.
+std::string centroidsInCells() {
+    constexpr std::int32_t WIDTH = 4096, DARK = 256;
+    Image image(WIDTH, 1);
+    for (std::int32_t x = 0; x < WIDTH; ++x)
+        image.row(0)[x] = x < DARK ? BLACK : 0xFFFDFDFD;
+    const auto prefixFunctions =
+        DensityMap::from(image).computePrefixFunctions();
+
+    std::vector<VoronoiBoundary> cells;
+    for (std::int32_t x = DARK; x < WIDTH; ++x)
+        cells.push_back({{Vector2(x, 0), Vector2(x, 0)}});
+    const std::vector<Vector2> centroids =
+        computeVoronoiCenters(cells, prefixFunctions);
+    if (centroids.size() != cells.size())
+        return std::to_string(centroids.size()) + " centroids of " +
+               std::to_string(cells.size()) + " cells";
+    for (std::size_t i = 0; i < cells.size(); ++i)
+        if (centroids[i].x != cells[i][0].first.x || centroids[i].y != 0)
+            return "the centroid of pixel " +
+                   std::to_string(cells[i][0].first.x) + " is at " +
+                   std::to_string(centroids[i].x);
+    return "";
+}
+
+// A part of the mask that holds no generator is never reached by the flood
+// fill; it must not pull any cell towards it. Twice on the same scratch, the
+// second time with the grids only reset inside the mask.
+std::string maskWithoutGenerator() {
+    constexpr std::int32_t WIDTH = 200, HEIGHT = 100, SIDE = 50;
+    Image image(WIDTH, HEIGHT);
+    image.fillByColor(0xFF808080);
+    const auto prefixFunctions =
+        DensityMap::from(image).computePrefixFunctions();
+    // the top left and the bottom right block.
+    const DomainMask mask(WIDTH, HEIGHT, [](std::size_t x, std::size_t y) {
+        return (x < SIDE && y < SIDE) ||
+               (x >= WIDTH - SIDE && y >= HEIGHT - SIDE);
+    });
+
+    VoronoiScratch scratch;
+    for (int step = 0; step < 2; ++step) {
+        std::vector<Vector2> generators{Vector2(10, 40)};
+        getVoronoiBoundaries(Vector2(WIDTH, HEIGHT), generators, scratch,
+                             nullptr, &mask);
+        const std::vector<Vector2> centroids =
+            computeVoronoiCenters(scratch.boundaries, prefixFunctions);
+        if (centroids.size() != 1 || centroids[0].x != SIDE / 2 - 1 ||
+            centroids[0].y != SIDE / 2 - 1)
+            return "step " + std::to_string(step) + ": the centroid is at " +
+                   (centroids.empty()
+                        ? std::string("none")
+                        : std::to_string(centroids[0].x) + ", " +
+                              std::to_string(centroids[0].y));
+    }
+    return "";
+}
+
+// An empty domain stipples to no generators at all, whose point set is a
+// header alone.
+std::string emptyPointSet() {
+    const std::string filename = temporaryFile();
+    std::string error;
+    try {
+        savePointSet({}, {64, 32, 1.5, BLACK}, filename);
+        const PointSet set(filename);
+        if (set.getCount() || set.getWidth() != 64 || set.getHeight() != 32)
+            error = "read back " + std::to_string(set.getCount()) +
+                    " points on " + std::to_string(set.getWidth()) + "x" +
+                    std::to_string(set.getHeight());
+    } catch (const char* message) {
+        error = message;
+    }
+    unlink(filename.c_str());
+    return error;
+}
+
+}  // namespace
+
+int main() {
+    std::vector<std::pair<std::string, Check>> checks;
+
+    // odd sizes, one strip and many (threads), incompressible and flat data.
+    const std::pair<std::size_t, std::size_t> SIZES[] = {
+        {1, 1}, {7, 3}, {257, 129}, {640, 480}};
+    for (const char* pattern : {"noise", "flat", "gradient", "dots"})
+        for (auto [width, height] : SIZES)
+            for (unsigned threads : {1u, 4u})
+                checks.push_back(
+                    {std::string("png ") + pattern + " " +
+                         std::to_string(width) + "x" + std::to_string(height) +
+                         ", " + std::to_string(threads) + " threads",
+                     [=]() {
+                         return pngRoundTrip(pattern, width, height, threads);
+                     }});
+
+    // sides past INT32_MAX or past size_t, rasters whose size wraps around
+    // to 0 and (16 bit RGB, sides within int32) to 32 bytes, and one that
+    // only exceeds the file.
+    for (const char* header :
+         {"P5 4294967296 4294967296 255\n", "P5 2147483648 1 255\n",
+          "P5 99999999999999999999999 1 255\n",
+          "P6 1684887088 1824726041 65535\n",
+          "P6 1073741824 1073741824 65535\n"})
+        checks.push_back(
+            {"netpbm header " + std::string(header, std::strlen(header) - 1),
+             [=]() { return oversizedNetpbm(header); }});
+
+    for (int value = (int)CpuLevel::AVX2; value <= (int)detectCpuLevel();
+         ++value) {
+        const CpuLevel level = (CpuLevel)value;
+        checks.push_back({std::string("blend ") + cpuLevelName(level) +
+                              " matches scalar",
+                          [=]() { return blendMatchesScalar(level); }});
+    }
+
+    checks.push_back({"centroids stay in their cells", centroidsInCells});
+    checks.push_back({"mask part without a generator", maskWithoutGenerator});
+    checks.push_back({"empty point set", emptyPointSet});
+
+    std::size_t failed = 0;
+    for (auto& [name, check] : checks) {
+        std::string error;
+        try {
+            error = check();
+        } catch (const char* message) {
+            error = message;
+        }
+        std::cout << name << ": " << (error.empty() ? "ok" : "FAILED, " + error)
+                  << '\n';
+        failed += !error.empty();
+    }
+    std::cout << "CHECK: " << checks.size() << " checks, " << failed
+              << " failed\n";
+    return failed ? 1 : 0;
+}
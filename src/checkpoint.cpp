@@ -0,0 +1,123 @@
+#include "checkpoint.hpp"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "trace.hpp"
+
+namespace {
+
+constexpr char MAGIC[4] = {'S', 'T', 'C', 'P'};
+constexpr std::uint32_t VERSION = 1;
+
+// followed by `count` pairs of int32 coordinates.
+struct CheckpointHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t imageHash;
+    std::uint32_t width, height;
+    std::uint32_t points, seed, initMode, bandRows;
+    // a labelling of 0 (flood) was reserved before there were others.
+    std::uint32_t iteration, labelling;
+    Random::State random;
+    std::uint64_t count;
+};
+
+bool sameKey(const CheckpointHeader& header, const CheckpointKey& key) {
+    return header.imageHash == key.imageHash && header.width == key.width &&
+           header.height == key.height && header.points == key.points &&
+           header.seed == key.seed && header.initMode == key.initMode &&
+           header.bandRows == key.bandRows &&
+           header.labelling == key.labelling;
+}
+
+}  // namespace
+
+void saveCheckpoint(const std::string filename, const CheckpointKey& key,
+                    const StippleState& state) {
+    TRACE_SCOPE("checkpoint");
+    const std::string temporary = filename + ".tmp";
+
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == NULL) {
+        std::cerr << "WARNING: could not write checkpoint: '" << temporary
+                  << "'.\n";
+        return;
+    }
+
+    CheckpointHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.imageHash = key.imageHash;
+    header.width = key.width;
+    header.height = key.height;
+    header.points = key.points;
+    header.seed = key.seed;
+    header.initMode = key.initMode;
+    header.bandRows = key.bandRows;
+    header.labelling = key.labelling;
+    header.iteration = state.iteration;
+    header.random = state.random;
+    header.count = state.generators.size();
+
+    std::vector<std::int32_t> coords;
+    coords.reserve(2 * state.generators.size());
+    for (auto& generator : state.generators) {
+        coords.push_back(generator.x);
+        coords.push_back(generator.y);
+    }
+
+    // on disk before the rename, so that a crash leaves the old or the new
+    // checkpoint, never a torn one.
+    bool written =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(coords.data(), sizeof(std::int32_t), coords.size(), file) ==
+            coords.size() &&
+        fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = (fclose(file) == 0) && written;
+
+    if (!written || rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::cerr << "WARNING: could not write checkpoint: '" << filename
+                  << "'.\n";
+        remove(temporary.c_str());
+    }
+}
+
+bool loadCheckpoint(const std::string filename, const CheckpointKey& key,
+                    StippleState& state) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) return false;
+
+    CheckpointHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                 std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                 header.version == VERSION;
+    if (valid && !sameKey(header, key)) {
+        fclose(file);
+        throw "Checkpoint was written for another image or other "
+              "parameters.\n";
+    }
+
+    std::vector<std::int32_t> coords;
+    valid = valid && header.count <= header.points;
+    if (valid) {
+        coords.resize(2 * header.count);
+        valid = fread(coords.data(), sizeof(std::int32_t), coords.size(),
+                      file) == coords.size() &&
+                fgetc(file) == EOF;
+    }
+    fclose(file);
+    if (!valid) throw "Checkpoint file is corrupted.\n";
+
+    state.iteration = header.iteration;
+    state.random = header.random;
+    state.generators.clear();
+    state.generators.reserve(header.count);
+    for (std::uint64_t i = 0; i < header.count; ++i)
+        state.generators.push_back(Vector2(coords[2 * i], coords[2 * i + 1]));
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef STIPPLING_CHECKPOINT_
+#define STIPPLING_CHECKPOINT_
+
+#include <cstdint>
+#include <string>
+
+#include "stipple.hpp"
+
+// Everything a relaxation depends on, besides how many steps it takes. The
+// image hash covers the density and the domain mask, if any.
+struct CheckpointKey {
+    std::uint64_t imageHash;
+    std::uint32_t width, height;
+    std::uint32_t points, seed, initMode, bandRows;
+    std::uint32_t labelling;
+};
+
+// Replaces the file at `filename` with `state` atomically: the file always
+// holds a whole state, even after a crash.
+void saveCheckpoint(const std::string filename, const CheckpointKey& key,
+                    const StippleState& state);
+
+// Returns false when there is no file at `filename`, throws when it is
+// unusable or was written for another key.
+bool loadCheckpoint(const std::string filename, const CheckpointKey& key,
+                    StippleState& state);
+
+#endif  // STIPPLING_CHECKPOINT_
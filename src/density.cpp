@@ -0,0 +1,235 @@
+#include "density.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "kernels.hpp"
+#include "trace.hpp"
+
+DensityMap::DensityMap(size_t width, size_t height)
+    : width(width),
+      height(height),
+      stride(width),
+      charge(Subsystem::Density, height * width * sizeof(float)) {
+    data.assign(height * width, 0.0f);
+}
+
+size_t DensityMap::getWidth() const { return width; }
+size_t DensityMap::getHeight() const { return height; }
+
+DensityMap DensityMap::from(const Image& img) {
+    TRACE_SCOPE("darkness");
+    DensityMap density(img.getWidth(), img.getHeight());
+    rgbaToDarkness(img.getPixels(), density.data.data(),
+                   density.width * density.height);
+    return density;
+}
+
+DensityMap DensityMap::from(const GrayImage& img) {
+    TRACE_SCOPE("darkness");
+    DensityMap density(img.getWidth(), img.getHeight());
+    for (size_t y = 0; y < density.height; ++y)
+        lumaToDarkness(img.row(y), density.data.data() + y * density.stride,
+                       density.width);
+    return density;
+}
+
+std::pair<PrefixFunction, PrefixFunction> DensityMap::computePrefixFunctions()
+    const {
+    std::pair<PrefixFunction, PrefixFunction> prefixFunctions;
+    computePrefixFunctions(prefixFunctions);
+    return prefixFunctions;
+}
+
+void DensityMap::computePrefixFunctions(
+    std::pair<PrefixFunction, PrefixFunction>& prefixFunctions) const {
+    TRACE_SCOPE("prefix");
+    auto& [P, Q] = prefixFunctions;
+    P.resize(height);
+    Q.resize(height);
+
+    // the products are vectorized, the long double sums cannot be.
+    std::vector<float> weighted(width);
+    for (std::size_t y = 0; y < height; ++y) {
+        const float* darkness = row(y);
+        P[y].resize(width);
+        Q[y].resize(width);
+        columnWeighted(darkness, weighted.data(), width);
+
+        P[y][0] = darkness[0];
+        Q[y][0] = 0.0;
+
+        for (std::size_t x = 1; x < width; ++x) {
+            P[y][x] = P[y][x - 1] + darkness[x];
+            Q[y][x] = Q[y][x - 1] + weighted[x];
+        }
+    }
+}
+
+void DensityMapBandReader::read(size_t y, size_t rows,
+                                std::vector<float>& band) {
+    const size_t width = density.getWidth();
+    band.resize(rows * width);
+    for (size_t r = 0; r < rows; ++r)
+        std::copy(density.row(y + r), density.row(y + r) + width,
+                  band.data() + r * width);
+}
+
+void NetpbmBandReader::read(size_t y, size_t rows, std::vector<float>& band) {
+    const size_t width = file.getWidth();
+    band.resize(rows * width);
+
+    for (size_t r = 0; r < rows; ++r) {
+        if (file.isGray()) {
+            luma.resize(width);
+            file.readLumaRow(y + r, luma.data());
+            lumaToDarkness(luma.data(), band.data() + r * width, width);
+        } else {
+            pixels.resize(width);
+            file.readRow(y + r, pixels.data());
+            rgbaToDarkness(pixels.data(), band.data() + r * width, width);
+        }
+    }
+
+    file.releaseRows(y, rows);
+}
+
+DensityMap DensityMap::from(DensityBandReader& reader) {
+    constexpr size_t BAND_ROWS = 256;
+    TRACE_SCOPE("darkness");
+
+    DensityMap density(reader.getWidth(), reader.getHeight());
+    std::vector<float> band;
+    for (size_t y = 0; y < density.height; y += BAND_ROWS) {
+        const size_t rows = std::min(BAND_ROWS, density.height - y);
+        reader.read(y, rows, band);
+        std::copy(band.begin(), band.end(),
+                  density.data.begin() + y * density.stride);
+    }
+    return density;
+}
+
+namespace {
+
+// Overlap of the source cells [floor(from), ceil(to)) with [from, to).
+template <typename Visit>
+void forEachCell(double from, double to, size_t limit, Visit visit) {
+    const size_t last = std::min(limit, (size_t)std::ceil(to));
+    for (size_t cell = std::floor(from); cell < last; ++cell) {
+        const double weight =
+            std::min(to, cell + 1.0) - std::max(from, (double)cell);
+        if (weight > 0) visit(cell, weight);
+    }
+}
+
+}  // namespace
+
+ResampledBandReader::ResampledBandReader(DensityBandReader& source,
+                                         size_t width, size_t height)
+    : source(source),
+      width(width),
+      height(height),
+      scaleX((double)source.getWidth() / width),
+      scaleY((double)source.getHeight() / height) {
+    first.push_back(0);
+    for (size_t x = 0; x < width; ++x) {
+        forEachCell(x * scaleX, (x + 1) * scaleX, source.getWidth(),
+                    [&](size_t cell, double weight) {
+                        columns.push_back(cell);
+                        weights.push_back(weight);
+                    });
+        first.push_back(columns.size());
+    }
+}
+
+void ResampledBandReader::read(size_t y, size_t rows,
+                               std::vector<float>& band) {
+    const size_t sourceWidth = source.getWidth();
+    const size_t top = std::floor(y * scaleY);
+    const size_t bottom = std::min(source.getHeight(),
+                                   (size_t)std::ceil((y + rows) * scaleY));
+    source.read(top, bottom - top, sourceBand);
+
+    // horizontally first, one source row at a time.
+    filtered.assign((bottom - top) * width, 0.0);
+    for (size_t r = 0; r < bottom - top; ++r) {
+        const float* in = sourceBand.data() + r * sourceWidth;
+        double* out = filtered.data() + r * width;
+        for (size_t x = 0; x < width; ++x)
+            for (size_t i = first[x]; i < first[x + 1]; ++i)
+                out[x] += weights[i] * in[columns[i]];
+    }
+
+    band.assign(rows * width, 0.0f);
+    const double area = scaleX * scaleY;
+    std::vector<double> sum(width);
+    for (size_t r = 0; r < rows; ++r) {
+        std::fill(sum.begin(), sum.end(), 0.0);
+        forEachCell((y + r) * scaleY, (y + r + 1) * scaleY, bottom,
+                    [&](size_t cell, double weight) {
+                        const double* in =
+                            filtered.data() + (cell - top) * width;
+                        for (size_t x = 0; x < width; ++x)
+                            sum[x] += weight * in[x];
+                    });
+        for (size_t x = 0; x < width; ++x)
+            band[r * width + x] = sum[x] / area;
+    }
+}
+
+void MaskedBandReader::read(size_t y, size_t rows,
+                            std::vector<float>& band) {
+    const size_t width = source.getWidth();
+    source.read(y, rows, band);
+
+    for (size_t r = 0; r < rows; ++r) {
+        float* row = band.data() + r * width;
+        std::int32_t x = 0;
+        const DomainMask::Run* run = mask.rowBegin(y + r);
+        for (; run != mask.rowEnd(y + r); ++run) {
+            std::fill(row + x, row + run->begin, 0.0f);
+            x = run->end;
+        }
+        std::fill(row + x, row + width, 0.0f);
+    }
+}
+
+void fillTiledDensity(DensityBandReader& reader, TiledDensity& density) {
+    const size_t width = density.getWidth(), height = density.getHeight(),
+                 tileSize = density.getTileSize();
+
+    std::vector<float> band;
+    for (size_t ty = 0; ty < density.getTilesY(); ++ty) {
+        const size_t y = ty * tileSize, rows = std::min(tileSize, height - y);
+        reader.read(y, rows, band);
+
+        for (size_t tx = 0; tx < density.getTilesX(); ++tx) {
+            const size_t x = tx * tileSize;
+            const size_t columns = std::min(tileSize, width - x);
+            float* tile = density.tile(tx, ty);
+            for (size_t r = 0; r < rows; ++r)
+                std::copy(band.data() + r * width + x,
+                          band.data() + r * width + x + columns,
+                          tile + r * tileSize);
+        }
+    }
+}
+
+void TiledDensityBandReader::read(size_t y, size_t rows,
+                                  std::vector<float>& band) {
+    const size_t width = density.getWidth(), tileSize = density.getTileSize();
+    band.resize(rows * width);
+
+    // column of tiles after column of tiles, so that only the (at most two)
+    // tiles of the current column need to be resident.
+    for (size_t tx = 0; tx < density.getTilesX(); ++tx) {
+        const size_t x = tx * tileSize;
+        const size_t columns = std::min(tileSize, width - x);
+        for (size_t r = 0; r < rows; ++r) {
+            const size_t row = y + r;
+            const float* tile =
+                density.tile(tx, row / tileSize) + (row % tileSize) * tileSize;
+            std::copy(tile, tile + columns, band.data() + r * width + x);
+        }
+    }
+}
@@ -0,0 +1,152 @@
+#ifndef STIPPLING_DENSITY_
+#define STIPPLING_DENSITY_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Vector2.hpp"
+#include "image.hpp"
+#include "mask.hpp"
+#include "memory.hpp"
+#include "tiled.hpp"
+
+class DensityBandReader;
+
+// Darkness of every pixel of an image in single precision, computed once and
+// then borrowed read-only by sampling, prefix construction, etc.
+class DensityMap {
+   private:
+    std::vector<float> data;
+    size_t width, height, stride;
+    MemoryCharge charge;
+
+   public:
+    DensityMap(size_t width, size_t height);
+
+    static DensityMap from(const Image& img);
+    static DensityMap from(const GrayImage& img);
+    // Reads the whole of `reader`, see DensityBandReader.
+    static DensityMap from(DensityBandReader& reader);
+
+    size_t getWidth() const;
+    size_t getHeight() const;
+
+    float getDensity(Vector2 coord) const {
+        return data[coord.y * stride + coord.x];
+    }
+    const float* row(size_t y) const { return data.data() + y * stride; }
+    const float* getData() const { return data.data(); }
+
+    std::pair<PrefixFunction, PrefixFunction> computePrefixFunctions() const;
+    // Same, into the storage `prefixFunctions` already has.
+    void computePrefixFunctions(
+        std::pair<PrefixFunction, PrefixFunction>& prefixFunctions) const;
+};
+
+// Produces the darkness of an image one band of rows at a time, so that
+// consumers never need the full density plane in memory.
+class DensityBandReader {
+   public:
+    virtual ~DensityBandReader() = default;
+
+    virtual size_t getWidth() const = 0;
+    virtual size_t getHeight() const = 0;
+
+    // Fills `band` with the darkness of rows [y, y + rows), row after row.
+    virtual void read(size_t y, size_t rows, std::vector<float>& band) = 0;
+};
+
+class DensityMapBandReader : public DensityBandReader {
+   private:
+    const DensityMap& density;
+
+   public:
+    DensityMapBandReader(const DensityMap& density) : density(density) {}
+
+    size_t getWidth() const override { return density.getWidth(); }
+    size_t getHeight() const override { return density.getHeight(); }
+
+    void read(size_t y, size_t rows, std::vector<float>& band) override;
+};
+
+// Converts a binary PGM/PPM file band by band, the rows of a band are dropped
+// from memory as soon as they are converted.
+class NetpbmBandReader : public DensityBandReader {
+   private:
+    NetpbmFile file;
+    std::vector<Color> pixels;
+    std::vector<std::uint8_t> luma;
+
+   public:
+    NetpbmBandReader(const std::string filename) : file(filename) {}
+
+    size_t getWidth() const override { return file.getWidth(); }
+    size_t getHeight() const override { return file.getHeight(); }
+
+    void read(size_t y, size_t rows, std::vector<float>& band) override;
+};
+
+// Box filtered resampling of another reader to `width` x `height`: every
+// output pixel is the mean darkness of the source area it covers. Only the
+// source rows under the requested band are read.
+class ResampledBandReader : public DensityBandReader {
+   private:
+    DensityBandReader& source;
+    size_t width, height;
+    double scaleX, scaleY;
+
+    // per output column, the source columns [first[x], first[x + 1]) of
+    // `columns` it covers and by how much.
+    std::vector<size_t> first, columns;
+    std::vector<double> weights;
+    std::vector<float> sourceBand;
+    std::vector<double> filtered;
+
+   public:
+    ResampledBandReader(DensityBandReader& source, size_t width,
+                        size_t height);
+
+    size_t getWidth() const override { return width; }
+    size_t getHeight() const override { return height; }
+
+    void read(size_t y, size_t rows, std::vector<float>& band) override;
+};
+
+// Another reader with the darkness outside of `mask` (of the same size)
+// cleared, so that no mass is ever found there.
+class MaskedBandReader : public DensityBandReader {
+   private:
+    DensityBandReader& source;
+    const DomainMask& mask;
+
+   public:
+    MaskedBandReader(DensityBandReader& source, const DomainMask& mask)
+        : source(source), mask(mask) {}
+
+    size_t getWidth() const override { return source.getWidth(); }
+    size_t getHeight() const override { return source.getHeight(); }
+
+    void read(size_t y, size_t rows, std::vector<float>& band) override;
+};
+
+// Darkness plane stored out-of-core, see TiledStore.
+typedef TiledStore<float> TiledDensity;
+
+// Copies the whole of `reader` into `density`, one band of tiles at a time.
+void fillTiledDensity(DensityBandReader& reader, TiledDensity& density);
+
+class TiledDensityBandReader : public DensityBandReader {
+   private:
+    TiledDensity& density;
+
+   public:
+    TiledDensityBandReader(TiledDensity& density) : density(density) {}
+
+    size_t getWidth() const override { return density.getWidth(); }
+    size_t getHeight() const override { return density.getHeight(); }
+
+    void read(size_t y, size_t rows, std::vector<float>& band) override;
+};
+
+#endif  // STIPPLING_DENSITY_
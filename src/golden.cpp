@@ -0,0 +1,270 @@
+// Determinism harness. Stipples fixed synthetic images with fixed seeds
+// through every labelling engine, with the jobs spread over 1, 2 and 4
+// threads (each with its own StippleContext) and on every instruction set
+// the CPU supports, and compares the generators with the golden point sets
+// of a directory. Each job also gets that many threads of its own, which
+// only the nearest labelling and the centroids use in the relaxation. Any
+// generator that moved is a
+// failure, unless the change of the Lloyd energy stays within --tolerance;
+// the energy delta is reported either way. --update rewrites the golden
+// point sets instead.
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "density.hpp"
+#include "image.hpp"
+#include "job.hpp"
+#include "kernels.hpp"
+#include "parallel.hpp"
+#include "pointset.hpp"
+#include "stipple.hpp"
+#include "synthetic.hpp"
+#include "tiled.hpp"
+#include "vector_export.hpp"
+#include "voronoi.hpp"
+
+namespace {
+
+// not square and several tiles of DEFAULT_TILE_SIZE wide and high, so that
+// the tiled engine searches across tile borders.
+constexpr std::size_t WIDTH = 600, HEIGHT = 400;
+constexpr std::uint32_t POINTS = 2000;
+constexpr std::uint32_t ITERATIONS = 5;
+constexpr std::uint32_t SEED = 420;
+constexpr unsigned THREAD_COUNTS[] = {1, 2, 4};
+
+const SyntheticPattern PATTERNS[] = {
+    SyntheticPattern::Circles, SyntheticPattern::Gradient,
+    SyntheticPattern::Checkerboard, SyntheticPattern::Noise};
+
+// The flood fill and the nearest labelling label the whole density in
+// memory, the tiled engine one resident tile at a time (--max-memory). Its
+// budget holds two of the six tiles of the plane (the least TileCache
+// keeps), so that tiles are evicted and mapped again.
+struct Engine {
+    const char* name;
+    std::size_t maxMemory;
+    Labelling labelling;
+};
+
+const Engine ENGINES[] = {
+    {"flood", 0, Labelling::Flood},
+    {"nearest", 0, Labelling::Nearest},
+    {"tiled", 2 * DEFAULT_TILE_SIZE * DEFAULT_TILE_SIZE * sizeof(float),
+     Labelling::Flood}};
+
+struct Case {
+    SyntheticPattern pattern;
+    const Engine* engine;
+    std::string input;
+
+    std::string name() const {
+        return std::string(syntheticName(pattern)) + "-" + engine->name;
+    }
+};
+
+std::string temporaryFile() {
+    char path[] = "/tmp/stipple-golden-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) throw "Could not create a temporary file.\n";
+    close(fd);
+    return path;
+}
+
+// The style the golden point sets are written with: one canvas pixel per
+// grid pixel, so the generators read back exactly.
+StippleStyle goldenStyle() { return {WIDTH, HEIGHT, 1.5, STIPPLE_COLOR}; }
+
+std::vector<Vector2> runCase(const Case& run, StippleContext& context,
+                             unsigned threads) {
+    const std::string points = temporaryFile();
+
+    Config config;
+    config.setVerbose(false);
+    config.setInFilename(run.input);
+    config.setPointsFilename(points);
+    config.setGeneratorPoints(POINTS);
+    config.setIterations(ITERATIONS);
+    config.setSeed(SEED);
+    config.setMaxMemory(run.engine->maxMemory);
+    config.setLabelling(run.engine->labelling);
+    config.setThreads(threads);
+
+    std::vector<Vector2> generators;
+    try {
+        runJob(config, &context);
+        const PointSet set(points);
+        for (std::size_t i = 0; i < set.getCount(); ++i)
+            generators.push_back(Vector2(std::floor(set.getX()[i]),
+                                         std::floor(set.getY()[i])));
+    } catch (...) {
+        unlink(points.c_str());
+        throw;
+    }
+    unlink(points.c_str());
+    return generators;
+}
+
+// Returns false when there is no usable golden file.
+bool loadGolden(const std::string filename, std::vector<Vector2>& generators) {
+    try {
+        const PointSet set(filename);
+        generators.clear();
+        for (std::size_t i = 0; i < set.getCount(); ++i)
+            generators.push_back(Vector2(std::floor(set.getX()[i]),
+                                         std::floor(set.getY()[i])));
+        return true;
+    } catch (const char*) {
+        return false;
+    }
+}
+
+// Lloyd energy: the darkness weighted squared distance of every pixel to
+// the generator of its cell.
+double energy(const DensityMap& density, std::vector<Vector2> generators) {
+    VoronoiScratch scratch;
+    const Vector2 dimensions(density.getWidth(), density.getHeight());
+    getVoronoiDiagram(dimensions, generators, scratch);
+
+    double sum = 0;
+    for (std::int32_t y = 0; y < dimensions.y; ++y)
+        for (std::int32_t x = 0; x < dimensions.x; ++x) {
+            const Vector2 d =
+                Vector2(x, y) - generators[scratch.labels[y][x]];
+            sum += density.getDensity(Vector2(x, y)) *
+                   ((double)d.x * d.x + (double)d.y * d.y);
+        }
+    return sum;
+}
+
+std::size_t moved(const std::vector<Vector2>& a,
+                  const std::vector<Vector2>& b) {
+    std::size_t count = std::max(a.size(), b.size()) -
+                        std::min(a.size(), b.size());
+    for (std::size_t i = 0; i < std::min(a.size(), b.size()); ++i)
+        count += a[i].x != b[i].x || a[i].y != b[i].y;
+    return count;
+}
+
+// Prints the verdict on the generators of one run of `run`.
+bool check(const Case& run, const std::vector<Vector2>& generators,
+           const std::string directory, double tolerance) {
+    std::vector<Vector2> golden;
+    if (!loadGolden(directory + "/" + run.name() + ".stps", golden)) {
+        std::cout << "FAILED, no golden point set\n";
+        return false;
+    }
+
+    const std::size_t count = moved(golden, generators);
+    if (!count) {
+        std::cout << "ok\n";
+        return true;
+    }
+
+    const DensityMap density =
+        DensityMap::from(syntheticImage(run.pattern, WIDTH, HEIGHT, SEED));
+    const double before = energy(density, golden);
+    const double after = energy(density, generators);
+    const double delta = (after - before) / before;
+    const bool within = std::abs(delta) <= tolerance;
+    std::cout << (within ? "ok within tolerance, " : "FAILED, ") << count
+              << " generators differ (" << golden.size() << " golden, "
+              << generators.size() << " now), energy " << std::showpos
+              << std::setprecision(3) << delta * 100 << std::noshowpos
+              << "%\n";
+    return within;
+}
+
+void usage() {
+    std::cerr << "Usage: stipple-golden [--update] [--tolerance REL] DIR\n"
+              << " --update    : rewrite the golden point sets of DIR\n"
+              << " --tolerance : relative Lloyd energy change accepted when\n"
+              << "               generators moved. Default: 0 (bit-exact)\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool update = false;
+    double tolerance = 0;
+    std::string directory;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string argument = argv[i];
+            if (argument == "--update")
+                update = true;
+            else if (argument == "--tolerance" && i + 1 < argc)
+                tolerance = std::stod(argv[++i]);
+            else if (argument[0] != '-' && directory.empty())
+                directory = argument;
+            else
+                throw 0;
+        }
+        if (directory.empty()) throw 0;
+    } catch (...) {
+        usage();
+        return 1;
+    }
+
+    std::vector<Case> cases;
+    std::vector<std::string> inputs;
+    for (auto pattern : PATTERNS) {
+        inputs.push_back(temporaryFile());
+        syntheticImage(pattern, WIDTH, HEIGHT, SEED).saveAsPGM(inputs.back());
+        for (auto& engine : ENGINES)
+            cases.push_back({pattern, &engine, inputs.back()});
+    }
+
+    if (update) {
+        StippleContext context;
+        for (auto& run : cases) {
+            savePointSet(runCase(run, context, 1), goldenStyle(),
+                         directory + "/" + run.name() + ".stps");
+            std::cout << "UPDATED: " << run.name() << '\n';
+        }
+        for (auto& input : inputs) unlink(input.c_str());
+        return 0;
+    }
+
+    std::vector<CpuLevel> levels;
+    for (int level = 0; level <= (int)detectCpuLevel(); ++level)
+        levels.push_back((CpuLevel)level);
+
+    std::size_t runs = 0, failed = 0;
+    for (CpuLevel level : levels) {
+        setCpuLevel(level);
+        for (unsigned threads : THREAD_COUNTS) {
+            std::vector<std::unique_ptr<StippleContext>> contexts(threads);
+            for (auto& context : contexts)
+                context = std::make_unique<StippleContext>();
+
+            std::vector<std::vector<Vector2>> results(cases.size());
+            parallelForWorker(
+                cases.size(), threads, [&](std::size_t i, unsigned worker) {
+                    results[i] =
+                        runCase(cases[i], *contexts[worker], threads);
+                });
+
+            for (std::size_t i = 0; i < cases.size(); ++i) {
+                std::cout << cases[i].name() << ", " << threads
+                          << " threads, " << cpuLevelName(level) << ": ";
+                ++runs;
+                failed += !check(cases[i], results[i], directory, tolerance);
+            }
+        }
+    }
+
+    for (auto& input : inputs) unlink(input.c_str());
+    std::cout << "GOLDEN: " << runs << " runs, " << failed << " failed\n";
+    return failed ? 1 : 0;
+}
@@ -1,10 +1,75 @@
 #include "image.hpp"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cstdio>
 
-#include "thirdparty/stb_image_write.h"
+#include "png.hpp"
+#include "trace.hpp"
 #include "thirdparty/stb_image.h"
+#include "writer.hpp"
+
+namespace {
+
+// pixels converted per claim() on the output buffer.
+constexpr std::size_t NETPBM_CHUNK = 1 << 14;
+
+struct NetpbmHeader {
+    std::size_t channels, width, height, maxval, offset;
+};
+
+// Parses the text header of a binary netpbm file, returns false if the data
+// is not a (supported) P5/P6 file.
+bool parseNetpbmHeader(const unsigned char* data, std::size_t size,
+                       NetpbmHeader& header) {
+    if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6'))
+        return false;
+    header.channels = data[1] == '5' ? 1 : 3;
+
+    std::size_t pos = 2;
+    std::size_t* fields[] = {&header.width, &header.height, &header.maxval};
+    for (std::size_t* field : fields) {
+        // skip whitespace and comments
+        while (pos < size && (std::isspace(data[pos]) || data[pos] == '#')) {
+            if (data[pos] == '#')
+                while (pos < size && data[pos] != '\n') ++pos;
+            else
+                ++pos;
+        }
+
+        if (pos >= size || !std::isdigit(data[pos])) return false;
+        *field = 0;
+        while (pos < size && std::isdigit(data[pos])) {
+            *field = *field * 10 + (data[pos++] - '0');
+            // coordinates are int32 (Vector2), this also stops the overflow.
+            if (*field > INT32_MAX) return false;
+        }
+    }
+
+    // exactly one whitespace character separates the header from the raster
+    if (pos >= size || !std::isspace(data[pos])) return false;
+    header.offset = pos + 1;
+
+    if (!header.width || !header.height || !header.maxval ||
+        header.maxval > 65535)
+        return false;
+
+    // a raster size that wraps would pass the check below.
+    std::size_t raster;
+    const std::size_t sample = header.maxval > 255 ? 2 : 1;
+    if (__builtin_mul_overflow(header.width, header.height, &raster) ||
+        __builtin_mul_overflow(raster, header.channels * sample, &raster))
+        return false;
+    return raster <= size - header.offset;
+}
+
+}  // namespace
 
 bool Image::isValidVector(Vector2 vec) {
     return (0 <= vec.x && vec.x < (int32_t)width && 0 <= vec.y &&
@@ -14,15 +79,29 @@ bool Image::isValidVector(Vector2 vec) {
 size_t Image::getWidth() const { return width; }
 size_t Image::getHeight() const { return height; }
 
-Color Image::getColor(Vector2 coord) {
+Color Image::getColor(Vector2 coord) const {
     return data[coord.y * stride + coord.x];
 }
 
-Image::Image(size_t width, size_t height)
-    : width(width), height(height), stride(width) {
-    data.assign(height * width, BLACK);
+PixelMap::PixelMap(size_t count, Color color)
+    : pixels((Color*)malloc(count * sizeof(Color)), free),
+      count(count),
+      charge(Subsystem::PixelMap, count * sizeof(Color)) {
+    if (!pixels) throw "Could not allocate the pixel map.\n";
+    std::fill(data(), data() + count, color);
 }
 
+PixelMap::PixelMap(Color* pixels, size_t count, void (*release)(void*))
+    : pixels(pixels, release),
+      count(count),
+      charge(Subsystem::PixelMap, count * sizeof(Color)) {}
+
+Image::Image(size_t width, size_t height)
+    : data(height * width, BLACK), width(width), height(height), stride(width) {}
+
+Image::Image(size_t width, size_t height, PixelMap data)
+    : data(std::move(data)), width(width), height(height), stride(width) {}
+
 void Image::fillByColor(Color color) {
     for (size_t y = 0; y < height; ++y)
         for (size_t x = 0; x < width; ++x) fillPoint(Vector2(x, y), color);
@@ -66,60 +145,215 @@ double Image::getDarkness(Color color) {
     return darkness;
 }
 
-std::pair<PrefixFunction, PrefixFunction> Image::computePrefixFunctions() {
-    PrefixFunction P(getHeight(), std::vector<long double>(getWidth())),
-        Q(getHeight(), std::vector<long double>(getWidth()));
+Image Image::from(const std::string filename) {
+    if (NetpbmFile::format(filename)) return fromNetpbm(filename);
+    TRACE_SCOPE("load");
+
+    std::int32_t width, height, components;
+    Color* pixelData = (Color*)stbi_load(filename.c_str(), &width, &height, &components, 4);
+    if (pixelData == NULL) { throw "File probably does not exist to be loaded as image.\n"; }
+
+    assert((components == 4 or components == 3) && "Must have 3 or 4 components: RGB[A]\n");
+    assert(width > 0 && "Width must be positive\n");
+    assert(height > 0 && "Height must be positive\n");
+
+    // adopt the decoder buffer as is, stb allocates it with STBI_MALLOC.
+    Image img(width, height,
+              PixelMap(pixelData, 1ULL * width * height, stbi_image_free));
 
-    for (std::size_t y = 0; y < getHeight(); ++y) {
-        P[y][0] = Image::getDarkness(getColor(Vector2(0, y)));
-        Q[y][0] = 0.0;
+    // set the color of pixels with alpha 0 to WHITE, branch free so that it
+    // vectorizes. The alpha itself is kept, see DomainMask::fromAlpha.
+    Color* pixels = img.data.data();
+    const std::size_t count = img.data.size();
+    for (std::size_t i = 0; i < count; ++i)
+        pixels[i] |= -(Color)((pixels[i] >> (8 * 3)) == 0) & 0x00FFFFFF;
 
-        for (std::size_t x = 1; x < getWidth(); ++x) {
-            auto darkness = Image::getDarkness(getColor(Vector2(x, y)));
+    return img;
+}
 
-            P[y][x] = P[y][x - 1] + darkness;
-            Q[y][x] = Q[y][x - 1] + darkness * x;
+bool Image::probe(const std::string filename, size_t& width,
+                  size_t& height) {
+    if (NetpbmFile::format(filename)) {
+        try {
+            const NetpbmFile file(filename);
+            width = file.getWidth();
+            height = file.getHeight();
+            return true;
+        } catch (const char*) {
+            return false;
         }
     }
 
-    return std::make_pair(P, Q);
+    int w, h, components;
+    if (!stbi_info(filename.c_str(), &w, &h, &components)) return false;
+    width = w;
+    height = h;
+    return true;
 }
 
+void Image::saveAsPNG(const std::string filename, unsigned threads) const {
+    writePNG(filename, data.data(), width, height, stride, threads);
+}
 
-Image Image::from(const std::string filename) {
-    std::int32_t width, height, components;
-    Color* pixelData = (Color*)stbi_load(filename.c_str(), &width, &height, &components, 4);
-    if (pixelData == NULL) { throw "File probably does not exist to be loaded as image.\n"; }
+Image Image::fromNetpbm(const std::string filename) {
+    TRACE_SCOPE("load");
+    const NetpbmFile file(filename);
 
-    assert((components == 4 or components == 3) && "Must have 3 or 4 components: RGB[A]\n");
-    assert(width > 0 && "Width must be positive\n");
-    assert(height > 0 && "Height must be positive\n");
+    Image img(file.getWidth(), file.getHeight());
+    for (std::size_t y = 0; y < img.height; ++y)
+        file.readRow(y, img.data.data() + y * img.stride);
 
-    Image img(width, height);
-    for (std::int32_t y = 0; y < height; ++y) {
-        for (std::int32_t x = 0; x < width; ++x) {
-            std::size_t index = y * img.stride + x;
-            img.data[index] = pixelData[index];
+    return img;
+}
+
+void Image::saveAsPPM(const std::string filename) const {
+    BufferedWriter writer(filename);
+    writer.write("P6\n" + std::to_string(width) + " " +
+                 std::to_string(height) + "\n255\n");
+
+    for (std::size_t y = 0; y < height; ++y) {
+        const Color* row = data.data() + y * stride;
+        for (std::size_t from = 0; from < width; from += NETPBM_CHUNK) {
+            std::size_t to = std::min(width, from + NETPBM_CHUNK);
+            char* out = writer.claim(3 * (to - from));
+            for (std::size_t x = from; x < to; ++x) {
+                *out++ = (row[x] >> (8 * 0)) & 0xFF;
+                *out++ = (row[x] >> (8 * 1)) & 0xFF;
+                *out++ = (row[x] >> (8 * 2)) & 0xFF;
+            }
+        }
+    }
+
+    writer.close();
+}
+
+void Image::saveAsPGM(const std::string filename) const {
+    BufferedWriter writer(filename);
+    writer.write("P5\n" + std::to_string(width) + " " +
+                 std::to_string(height) + "\n255\n");
 
-            // check if alpha is 0, then set pixel as WHITE.
-            if (((img.data[index] >> (8 * 3)) & 0xFF) == 0)
-                img.data[index] = WHITE;
+    for (std::size_t y = 0; y < height; ++y) {
+        const Color* row = data.data() + y * stride;
+        for (std::size_t from = 0; from < width; from += NETPBM_CHUNK) {
+            std::size_t to = std::min(width, from + NETPBM_CHUNK);
+            char* out = writer.claim(to - from);
+            for (std::size_t x = from; x < to; ++x) {
+                std::uint32_t R = (row[x] >> (8 * 0)) & 0xFF,
+                              G = (row[x] >> (8 * 1)) & 0xFF,
+                              B = (row[x] >> (8 * 2)) & 0xFF;
+                // same Rec. 709 weights as getDarkness, in 16 bit fixed point
+                *out++ = (13933 * R + 46871 * G + 4732 * B + 32768) >> 16;
+            }
         }
     }
 
-    // NOTE: I have no clue if this memory is malloc-ed or not. Would
-    // have to read the source of stbi_load(). But too lazy.
-    free(pixelData);
+    writer.close();
+}
+
+GrayImage::GrayImage(size_t width, size_t height)
+    : width(width), height(height), stride(width) {
+    data.assign(height * width, 0);
+}
+
+size_t GrayImage::getWidth() const { return width; }
+size_t GrayImage::getHeight() const { return height; }
+
+bool GrayImage::isGrayNetpbm(const std::string filename) {
+    return NetpbmFile::format(filename) == '5';
+}
+
+GrayImage GrayImage::fromNetpbm(const std::string filename) {
+    TRACE_SCOPE("load");
+    const NetpbmFile file(filename);
+    if (!file.isGray()) throw "Not a binary PGM file.\n";
+
+    GrayImage img(file.getWidth(), file.getHeight());
+    for (std::size_t y = 0; y < img.height; ++y)
+        file.readLumaRow(y, img.data.data() + y * img.stride);
 
     return img;
 }
 
-void Image::saveAsPNG(const std::string filename) const {
-    stbi_write_png(filename.c_str(), width, height, 4, data.data(),
-                   stride * sizeof(Color));
+char NetpbmFile::format(const std::string filename) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) return 0;
+    unsigned char magic[2];
+    bool netpbm = fread(magic, 1, 2, file) == 2 && magic[0] == 'P' &&
+                  (magic[1] == '5' || magic[1] == '6');
+    fclose(file);
+    return netpbm ? magic[1] : 0;
 }
 
-void Image::saveAsPPM(const std::string filename) const {
-    (void)filename;
-    throw "Not Implemented.";
+NetpbmFile::NetpbmFile(const std::string filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw "File probably does not exist to be loaded as image.\n";
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw "Could not stat the image file.\n";
+    }
+    size = st.st_size;
+
+    mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) throw "Could not map the image file.\n";
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    NetpbmHeader header;
+    if (!parseNetpbmHeader((const unsigned char*)mapped, size, header)) {
+        munmap(mapped, size);
+        throw "Not a binary PGM/PPM file.\n";
+    }
+
+    channels = header.channels;
+    width = header.width;
+    height = header.height;
+    maxval = header.maxval;
+    offset = header.offset;
+    sampleSize = maxval > 255 ? 2 : 1;
+}
+
+NetpbmFile::~NetpbmFile() { munmap(mapped, size); }
+
+const unsigned char* NetpbmFile::row(size_t y) const {
+    return (const unsigned char*)mapped + offset +
+           y * width * channels * sampleSize;
+}
+
+std::uint32_t NetpbmFile::sample(const unsigned char* s) const {
+    // rescales 0..maxval to 0..255, 16 bit samples are big endian.
+    std::uint32_t v = sampleSize == 2 ? (s[0] << 8 | s[1]) : s[0];
+    return maxval == 255 ? v : (v * 255 + maxval / 2) / maxval;
+}
+
+void NetpbmFile::readRow(size_t y, Color* out) const {
+    const unsigned char* in = row(y);
+    const size_t pixel = channels * sampleSize;
+
+    for (size_t x = 0; x < width; ++x, in += pixel) {
+        std::uint32_t c[3];
+        for (size_t k = 0; k < 3; ++k)
+            c[k] = sample(in + (channels == 1 ? 0 : k * sampleSize));
+        out[x] = BLACK | c[2] << 16 | c[1] << 8 | c[0];
+    }
+}
+
+void NetpbmFile::readLumaRow(size_t y, std::uint8_t* out) const {
+    const unsigned char* in = row(y);
+    if (sampleSize == 1 && maxval == 255) {
+        std::copy(in, in + width, out);
+        return;
+    }
+    for (size_t x = 0; x < width; ++x) out[x] = sample(in + x * sampleSize);
+}
+
+void NetpbmFile::releaseRows(size_t y, size_t rows) const {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    // only the pages lying entirely within the rows are dropped.
+    size_t from = (size_t)row(y) - (size_t)mapped;
+    size_t to = (size_t)row(y + rows) - (size_t)mapped;
+    from = (from + page - 1) / page * page;
+    to = to / page * page;
+    if (from < to) madvise((char*)mapped + from, to - from, MADV_DONTNEED);
 }
@@ -2,13 +2,15 @@
 #define STIPPLING_IMAGE_
 
 #include <cstdint>
+#include <cstdlib>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "Vector2.hpp"
+#include "memory.hpp"
 
 typedef std::uint32_t Color;
-typedef std::vector<Color> PixelMap;
 typedef std::vector<std::vector<long double>> PrefixFunction;
 
 #define RED ((Color)0xFF0000FF)
@@ -17,6 +19,26 @@ typedef std::vector<std::vector<long double>> PrefixFunction;
 #define BLACK ((Color)0xFF000000)
 #define WHITE ((Color)0xFFFFFFFF)
 
+// Pixel storage, either allocated here or adopted from a decoder and then
+// handed back to it through `release`.
+class PixelMap {
+   private:
+    std::unique_ptr<Color, void (*)(void*)> pixels;
+    size_t count;
+    MemoryCharge charge;
+
+   public:
+    PixelMap(size_t count, Color color);
+    PixelMap(Color* pixels, size_t count, void (*release)(void*));
+
+    Color* data() { return pixels.get(); }
+    const Color* data() const { return pixels.get(); }
+    size_t size() const { return count; }
+
+    Color& operator[](size_t index) { return pixels.get()[index]; }
+    const Color& operator[](size_t index) const { return pixels.get()[index]; }
+};
+
 class Image {
    private:
     PixelMap data;
@@ -24,16 +46,26 @@ class Image {
 
     bool isValidVector(Vector2 coord);
 
+    Image(size_t width, size_t height, PixelMap data);
+
    public:
     Image(size_t width, size_t height);
 
     static double getDarkness(Color color);
     static Image from(const std::string filename);
+    // Binary PGM (P5) or PPM (P6), read through a memory mapping.
+    static Image fromNetpbm(const std::string filename);
+    // Reads no more than the header of `filename`, returns false if it is
+    // not an image that `from` can load.
+    static bool probe(const std::string filename, size_t& width,
+                      size_t& height);
 
     size_t getWidth() const;
     size_t getHeight() const;
 
-    Color getColor(Vector2 coord);
+    Color getColor(Vector2 coord) const;
+    const Color* getPixels() const { return data.data(); }
+    Color* row(size_t y) { return data.data() + y * stride; }
 
     void fillPoint(Vector2 coord, Color color) {
         data[coord.y * stride + coord.x] = color;
@@ -43,12 +75,69 @@ class Image {
     void fillRectangle(Vector2 topLeft, size_t width, size_t height,
                        Color color);
 
-    std::pair<PrefixFunction, PrefixFunction> computePrefixFunctions();
-
     // Methods to save images to disk
-    void saveAsPNG(const std::string filename) const;
+    // Encoded on up to `threads` threads, see writePNG.
+    void saveAsPNG(const std::string filename, unsigned threads = 1) const;
     void saveAsPPM(const std::string filename) const;
+    void saveAsPGM(const std::string filename) const;
+
+};
+
+// Single channel, 8 bit luma image; a quarter of the size of an Image.
+class GrayImage {
+   private:
+    std::vector<std::uint8_t> data;
+    size_t width, height, stride;
+
+   public:
+    GrayImage(size_t width, size_t height);
+
+    // Whether `filename` is a binary PGM (P5), which loads without ever
+    // expanding to RGBA.
+    static bool isGrayNetpbm(const std::string filename);
+    static GrayImage fromNetpbm(const std::string filename);
+
+    size_t getWidth() const;
+    size_t getHeight() const;
+
+    std::uint8_t getLuma(Vector2 coord) const {
+        return data[coord.y * stride + coord.x];
+    }
+    const std::uint8_t* row(size_t y) const { return data.data() + y * stride; }
+};
+
+// Binary PGM (P5) or PPM (P6) file, memory-mapped read-only and converted one
+// row at a time, so that it never has to be resident as a whole.
+class NetpbmFile {
+   private:
+    void* mapped;
+    size_t size;
+    size_t channels, width, height, maxval, offset, sampleSize;
+
+    const unsigned char* row(size_t y) const;
+    std::uint32_t sample(const unsigned char* s) const;
+
+   public:
+    NetpbmFile(const std::string filename);
+    ~NetpbmFile();
+
+    NetpbmFile(const NetpbmFile&) = delete;
+    NetpbmFile& operator=(const NetpbmFile&) = delete;
+
+    // Returns the format digit of `filename` ('5' or '6'), or 0.
+    static char format(const std::string filename);
+
+    size_t getWidth() const { return width; }
+    size_t getHeight() const { return height; }
+    bool isGray() const { return channels == 1; }
+
+    void readRow(size_t y, Color* out) const;
+    // Only for gray files.
+    void readLumaRow(size_t y, std::uint8_t* out) const;
 
+    // Drops the pages of rows [y, y + rows) from memory, they are read again
+    // from the file if needed.
+    void releaseRows(size_t y, size_t rows) const;
 };
 
 #endif  // STIPPLING_IMAGE_
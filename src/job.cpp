@@ -0,0 +1,432 @@
+#include "job.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "cache.hpp"
+#include "checkpoint.hpp"
+#include "density.hpp"
+#include "mask.hpp"
+#include "memory.hpp"
+#include "pointset.hpp"
+#include "render.hpp"
+#include "snapshot.hpp"
+#include "trace.hpp"
+#include "vector_export.hpp"
+#include "voronoi.hpp"
+
+bool hasExtension(const std::string filename, const std::string extension) {
+    return filename.size() >= extension.size() &&
+           filename.compare(filename.size() - extension.size(),
+                            extension.size(), extension) == 0;
+}
+
+namespace {
+
+void checkCancelled(const std::atomic<bool>* cancelled) {
+    if (cancelled && cancelled->load(std::memory_order_relaxed))
+        throw JobCancelled();
+}
+
+void saveImage(const Config& config, const Image& img,
+               const std::string filename) {
+    if (hasExtension(filename, ".ppm"))
+        img.saveAsPPM(filename);
+    else if (hasExtension(filename, ".pgm"))
+        img.saveAsPGM(filename);
+    else
+        img.saveAsPNG(filename, config.getThreads());
+}
+
+// Size of the grid the stipple is computed on, for an input of `native` size.
+Vector2 computeSize(const Config& config, Vector2 native) {
+    const double scale = config.getComputeScale();
+    return Vector2(std::max(1L, std::lround(native.x * scale)),
+                   std::max(1L, std::lround(native.y * scale)));
+}
+
+// Size of the output canvas, for an input of `native` size.
+Vector2 outputSize(const Config& config, Vector2 native) {
+    if (!config.getOutputWidth()) return native;
+
+    const std::int32_t width = config.getOutputWidth();
+    if (config.getOutputHeight())
+        return Vector2(width, config.getOutputHeight());
+    return Vector2(width, std::max(1L, std::lround((double)width * native.y /
+                                                   native.x)));
+}
+
+// The dots reach half a pixel past the radius, as fillCircle (covering the
+// pixel centers within the radius) always drew them.
+StippleStyle stippleStyle(const Config& config, Vector2 grid, Vector2 native) {
+    const Vector2 canvas = outputSize(config, native);
+    StippleStyle style{(std::size_t)canvas.x, (std::size_t)canvas.y,
+                       config.getGeneratorRadius() + 0.5,
+                       STIPPLE_COLOR};
+    style.scaleX = (double)canvas.x / grid.x;
+    style.scaleY = (double)canvas.y / grid.y;
+    return style;
+}
+
+// Returns false if `filename` is not a vector format, and nothing is written.
+bool saveStipples(const std::vector<Vector2>& generators,
+                  const StippleStyle& style, const std::string filename) {
+    if (hasExtension(filename, ".svg"))
+        saveStipplesAsSVG(generators, style, filename);
+    else if (hasExtension(filename, ".eps"))
+        saveStipplesAsEPS(generators, style, filename);
+    else if (hasExtension(filename, ".pdf"))
+        saveStipplesAsPDF(generators, style, filename);
+    else
+        return false;
+
+    return true;
+}
+
+// Vector or raster image of the stipples, by the extension of `filename`.
+void saveStippleImage(const Config& config,
+                      const std::vector<Vector2>& generators,
+                      const StippleStyle& style, const std::string filename) {
+    if (saveStipples(generators, style, filename)) return;
+
+    // the raster canvas is only allocated for raster outputs.
+    Image img(style.width, style.height);
+    img.fillByColor(WHITE);
+    renderStipples(generators, style, img, config.getThreads());
+
+    saveImage(config, img, filename);
+}
+
+// `generators` are on a `grid` sized grid, computed for a `native` sized
+// input.
+void saveGenerators(const Config& config,
+                    const std::vector<Vector2>& generators, Vector2 grid,
+                    Vector2 native) {
+    TRACE_SCOPE("save");
+    const StippleStyle style = stippleStyle(config, grid, native);
+
+    if (!config.getPointsFilename().empty()) {
+        savePointSet(generators, style, config.getPointsFilename());
+        // with a point set, the image is only written when asked for.
+        if (!config.hasOutFilename()) return;
+    }
+
+    saveStippleImage(config, generators, style, config.getOutFilename());
+}
+
+// `filename` with the iteration before its extension: photo.0005.png.
+std::string frameFilename(const std::string filename, std::size_t iteration) {
+    char number[16];
+    snprintf(number, sizeof(number), ".%04zu", iteration);
+
+    const std::size_t slash = filename.find_last_of('/');
+    const std::size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash))
+        return filename + number;
+    return filename.substr(0, dot) + number + filename.substr(dot);
+}
+
+// The RGBA image is only alive while its darkness is computed, a binary PGM
+// is read as 8 bit luma and never expanded. `alpha` receives the opaque
+// pixels of images that have transparent ones.
+DensityMap loadDensity(const std::string filename,
+                       std::unique_ptr<DomainMask>& alpha) {
+    if (GrayImage::isGrayNetpbm(filename))
+        return DensityMap::from(GrayImage::fromNetpbm(filename));
+
+    const Image img = Image::from(filename);
+    DomainMask opaque = DomainMask::fromAlpha(img);
+    if (!opaque.isFull()) alpha = std::make_unique<DomainMask>(opaque);
+    return DensityMap::from(img);
+}
+
+// The domain of the stipple on the compute `grid`: the --mask image, else
+// the opaque pixels of the input, else none at all.
+std::unique_ptr<DomainMask> loadDomain(const Config& config,
+                                       std::unique_ptr<DomainMask> alpha,
+                                       Vector2 grid) {
+    std::unique_ptr<DomainMask> domain = std::move(alpha);
+    if (!config.getMaskFilename().empty())
+        domain = std::make_unique<DomainMask>(
+            DomainMask::fromImage(Image::from(config.getMaskFilename())));
+
+    if (domain && (domain->getWidth() != (std::size_t)grid.x ||
+                   domain->getHeight() != (std::size_t)grid.y))
+        domain =
+            std::make_unique<DomainMask>(domain->resampled(grid.x, grid.y));
+    return domain;
+}
+
+// Puts the resampling to the compute `grid` and the clearing outside of
+// `domain` in front of `reader`, as needed. `stages` owns what was added.
+DensityBandReader& computeReader(
+    DensityBandReader& reader, Vector2 grid, const DomainMask* domain,
+    std::vector<std::unique_ptr<DensityBandReader>>& stages) {
+    DensityBandReader* input = &reader;
+    if (reader.getWidth() != (std::size_t)grid.x ||
+        reader.getHeight() != (std::size_t)grid.y) {
+        stages.push_back(
+            std::make_unique<ResampledBandReader>(*input, grid.x, grid.y));
+        input = stages.back().get();
+    }
+    if (domain) {
+        stages.push_back(std::make_unique<MaskedBandReader>(*input, *domain));
+        input = stages.back().get();
+    }
+    return *input;
+}
+
+// The writer of the --checkpoint file, null without one. With --resume,
+// `resumed` first receives the state the file holds, if there is a file.
+std::unique_ptr<SnapshotWriter> openCheckpoint(
+    const Config& config, const CheckpointKey& key,
+    std::unique_ptr<StippleState>& resumed) {
+    const std::string filename = config.getCheckpointFilename();
+    if (filename.empty()) return nullptr;
+
+    if (config.getResume()) {
+        auto state = std::make_unique<StippleState>();
+        if (loadCheckpoint(filename, key, *state)) {
+            if (config.isVerbose())
+                std::cout << "RESUMED: iteration " << state->iteration
+                          << '\n';
+            resumed = std::move(state);
+        }
+    }
+    return std::make_unique<SnapshotWriter>(
+        [filename, key](const StippleState& state) {
+            saveCheckpoint(filename, key, state);
+        });
+}
+
+// The writer of the --emit-every frames, null without them. Frames that
+// come faster than they are rendered are skipped.
+std::unique_ptr<SnapshotWriter> openFrames(const Config& config, Vector2 grid,
+                                           Vector2 native) {
+    if (!config.getEmitEvery()) return nullptr;
+
+    const StippleStyle style = stippleStyle(config, grid, native);
+    return std::make_unique<SnapshotWriter>(
+        [&config, style](const StippleState& state) {
+            TRACE_SCOPE("frame");
+            try {
+                saveStippleImage(
+                    config, state.generators, style,
+                    frameFilename(config.getOutFilename(), state.iteration));
+            } catch (const char* error) {
+                std::cerr << "WARNING: " << error;
+            }
+        });
+}
+
+// Hash of what a relaxation runs on: the density, with that of `domain`.
+std::uint64_t contentHash(std::uint64_t densityHash, const DomainMask* domain) {
+    if (!domain) return densityHash;
+    const std::uint64_t hashes[] = {densityHash, GeneratorCache::hash(*domain)};
+    return GeneratorCache::hash(hashes, sizeof(hashes));
+}
+
+// Hashes the rows of another reader as they are read, so that a density
+// that is never resident as a whole is hashed all the same.
+class HashingBandReader : public DensityBandReader {
+   private:
+    DensityBandReader& source;
+    std::uint64_t hash = 0;
+
+   public:
+    HashingBandReader(DensityBandReader& source) : source(source) {}
+
+    size_t getWidth() const override { return source.getWidth(); }
+    size_t getHeight() const override { return source.getHeight(); }
+    // of the rows read so far, in the order they were read.
+    std::uint64_t getHash() const { return hash; }
+
+    void read(size_t y, size_t rows, std::vector<float>& band) override {
+        source.read(y, rows, band);
+        const size_t width = getWidth();
+        for (size_t r = 0; r < rows; ++r) {
+            const std::uint64_t hashes[] = {
+                hash, GeneratorCache::hash(band.data() + r * width,
+                                           width * sizeof(float))};
+            hash = GeneratorCache::hash(hashes, sizeof(hashes));
+        }
+    }
+};
+
+CheckpointKey checkpointKey(const Config& config, std::uint64_t imageHash,
+                            Vector2 grid, InitMode initMode,
+                            Labelling labelling) {
+    return {imageHash, (std::uint32_t)grid.x, (std::uint32_t)grid.y,
+            config.getGeneratorPoints(), config.getSeed(),
+            (std::uint32_t)initMode, config.getBandRows(),
+            (std::uint32_t)labelling};
+}
+
+// Every --checkpoint-every steps, and after the last one.
+bool checkpointDue(const Config& config, std::size_t iteration) {
+    return iteration % std::max(1u, config.getCheckpointEvery()) == 0 ||
+           iteration == config.getIterations();
+}
+
+// `density` is already resampled to the compute grid and cleared outside of
+// `domain` (if any), `native` is the size of the input.
+std::size_t stippleAndSave(const Config& config, const DensityMap& density,
+                           Vector2 native, const DomainMask* domain,
+                           StippleContext* context,
+                           const std::atomic<bool>* cancelled) {
+    std::vector<Vector2> generators;
+    {
+        // without a context to keep, its buffers are gone by the time the
+        // output is rendered.
+        std::unique_ptr<StippleContext> owned;
+        if (!context) {
+            owned = std::make_unique<StippleContext>();
+            context = owned.get();
+        }
+
+        const Vector2 grid(density.getWidth(), density.getHeight());
+        std::unique_ptr<StippleState> resumed;
+        std::unique_ptr<SnapshotWriter> checkpoints;
+        if (!config.getCheckpointFilename().empty())
+            checkpoints = openCheckpoint(
+                config,
+                checkpointKey(
+                    config, contentHash(GeneratorCache::hash(density), domain),
+                    grid, config.getInitMode(), config.getLabelling()),
+                resumed);
+        const std::unique_ptr<SnapshotWriter> frames =
+            openFrames(config, grid, native);
+
+        generators = context->stipple(
+            density, domain, config.getStippleParameters(),
+            [&](std::size_t iteration, const std::vector<Vector2>& current) {
+                if (config.isVerbose())
+                    std::cout << "ITERATION: " << iteration << '\n';
+                if (checkpoints && checkpointDue(config, iteration))
+                    checkpoints->submit(iteration, current,
+                                        context->getRandomState());
+                if (frames && iteration % config.getEmitEvery() == 0)
+                    frames->submit(iteration, current);
+                checkCancelled(cancelled);
+            },
+            resumed.get());
+    }
+
+    saveGenerators(config, generators,
+                   Vector2(density.getWidth(), density.getHeight()), native);
+    MemoryAccounting::checkpoint("save");
+    return generators.size();
+}
+
+// Same as stippleAndSave, but the density lives in a TiledDensity of which at
+// most --max-memory bytes are resident. Binary PGM/PPM inputs are streamed
+// from disk, other formats still have to be decoded in memory first.
+JobResult stippleOutOfCore(const Config& config,
+                           const std::atomic<bool>* cancelled) {
+    const std::string infile = config.getInFilename();
+
+    std::unique_ptr<DensityMap> decoded;
+    std::unique_ptr<DensityBandReader> reader;
+    std::unique_ptr<DomainMask> alpha;
+    if (NetpbmFile::format(infile)) {
+        reader = std::make_unique<NetpbmBandReader>(infile);
+    } else {
+        decoded = std::make_unique<DensityMap>(loadDensity(infile, alpha));
+        reader = std::make_unique<DensityMapBandReader>(*decoded);
+    }
+
+    const Vector2 native(reader->getWidth(), reader->getHeight());
+    const Vector2 grid = computeSize(config, native);
+    const std::unique_ptr<DomainMask> domain =
+        loadDomain(config, std::move(alpha), grid);
+
+    std::vector<std::unique_ptr<DensityBandReader>> stages;
+    DensityBandReader& input =
+        computeReader(*reader, grid, domain.get(), stages);
+
+    TiledDensity density(input.getWidth(), input.getHeight(),
+                         config.getMaxMemory(), config.getTileDirectory());
+    HashingBandReader hashed(input);
+    fillTiledDensity(hashed, density);
+    stages.clear();
+    reader.reset();
+    decoded.reset();
+
+    // every other initialisation needs the whole density plane.
+    TiledDensityBandReader bands(density);
+    MemoryAccounting::checkpoint("load");
+    Random random(config.getSeed());
+    std::unique_ptr<StippleState> resumed;
+    // out-of-core always labels by the nearest generator, whatever
+    // --labelling says; its keys keep the flood labelling they always had.
+    const std::unique_ptr<SnapshotWriter> checkpoints = openCheckpoint(
+        config,
+        checkpointKey(config, contentHash(hashed.getHash(), domain.get()), grid,
+                      InitMode::Streaming, Labelling::Flood),
+        resumed);
+    const std::unique_ptr<SnapshotWriter> frames =
+        openFrames(config, grid, native);
+
+    std::vector<Vector2> generators;
+    if (resumed) {
+        generators = std::move(resumed->generators);
+        random.setState(resumed->random);
+    } else {
+        generators = streamingSampling(config.getGeneratorPoints(), bands,
+                                       config.getBandRows(), random);
+        MemoryAccounting::checkpoint("sampling");
+    }
+
+    for (std::size_t i = resumed ? resumed->iteration : 0;
+         i < config.getIterations(); ++i) {
+        TRACE_SCOPE("iteration");
+        if (config.isVerbose())
+            std::cout << "ITERATION: " << i + 1 << '\n';
+        generators =
+            computeTiledVoronoiCenters(density, generators, domain.get());
+        snapToDomain(generators, domain.get());
+        MemoryAccounting::checkpoint("iteration " + std::to_string(i + 1));
+        if (checkpoints && checkpointDue(config, i + 1))
+            checkpoints->submit(i + 1, generators, random.getState());
+        if (frames && (i + 1) % config.getEmitEvery() == 0)
+            frames->submit(i + 1, generators);
+        checkCancelled(cancelled);
+    }
+
+    saveGenerators(config, generators,
+                   Vector2(density.getWidth(), density.getHeight()), native);
+    MemoryAccounting::checkpoint("save");
+    return {native, generators.size()};
+}
+
+}  // namespace
+
+JobResult runJob(const Config& config, StippleContext* context,
+                 const std::atomic<bool>* cancelled) {
+    if (config.getMaxMemory()) return stippleOutOfCore(config, cancelled);
+
+    std::unique_ptr<DomainMask> alpha;
+    DensityMap density = loadDensity(config.getInFilename(), alpha);
+
+    const Vector2 native(density.getWidth(), density.getHeight());
+    const Vector2 grid = computeSize(config, native);
+    const std::unique_ptr<DomainMask> domain =
+        loadDomain(config, std::move(alpha), grid);
+    {
+        DensityMapBandReader source(density);
+        std::vector<std::unique_ptr<DensityBandReader>> stages;
+        DensityBandReader& input =
+            computeReader(source, grid, domain.get(), stages);
+        if (!stages.empty()) density = DensityMap::from(input);
+    }
+    MemoryAccounting::checkpoint("load");
+    checkCancelled(cancelled);
+
+    return {native, stippleAndSave(config, density, native, domain.get(),
+                                   context, cancelled)};
+}
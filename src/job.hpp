@@ -0,0 +1,172 @@
+#ifndef STIPPLING_JOB_
+#define STIPPLING_JOB_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "Vector2.hpp"
+#include "image.hpp"
+#include "stipple.hpp"
+
+constexpr Color STIPPLE_COLOR = 0xFF181818;
+
+constexpr std::uint32_t DEFAULT_GENERATOR_RADIUS = 1;
+constexpr std::uint32_t DEFAULT_THREADS = 1;
+constexpr double DEFAULT_COMPUTE_SCALE = 1.0;
+constexpr const char* DEFAULT_INIT_MODE = "rejection";
+constexpr const char* DEFAULT_LABELLING = "flood";
+constexpr const char* DEFAULT_INFILE = "./example/butterfly.png";
+constexpr const char* DEFAULT_OUTFILE = "./photo.png";
+constexpr const char* DEFAULT_TILE_DIRECTORY = "/tmp";
+constexpr const char* DEFAULT_OUT_DIRECTORY = ".";
+constexpr std::size_t DEFAULT_QUEUE_DEPTH = 16;
+constexpr std::uint32_t DEFAULT_CHECKPOINT_EVERY = 10;
+
+// The options of one run of the command line tool, or of one job of a batch.
+class Config {
+   private:
+    std::uint32_t m_generatorPoints = DEFAULT_GENERATOR_POINTS;
+    std::uint32_t m_generatorRadius = DEFAULT_GENERATOR_RADIUS;
+    std::uint32_t m_iterations = DEFAULT_ITERATIONS;
+    std::uint32_t m_seed = DEFAULT_SEED;
+    InitMode m_initMode = InitMode::Rejection;
+    std::uint32_t m_bandRows = DEFAULT_BAND_ROWS;
+    Labelling m_labelling = Labelling::Flood;
+    std::string m_infilename = DEFAULT_INFILE;
+    std::string m_outfilename = DEFAULT_OUTFILE;
+    bool m_hasOutFilename = false;
+    std::string m_pointsFilename;
+    std::string m_maskFilename;
+    std::string m_checkpointFilename;
+    std::uint32_t m_checkpointEvery = DEFAULT_CHECKPOINT_EVERY;
+    bool m_resume = false;
+    std::uint32_t m_emitEvery = 0;
+    std::string m_traceFilename;
+    bool m_memReport = false;
+    std::string m_cacheDirectory;
+    std::size_t m_maxMemory = 0;
+    std::string m_tileDirectory = DEFAULT_TILE_DIRECTORY;
+    std::uint32_t m_threads = DEFAULT_THREADS;
+    // when set, the threads of every relaxation step (see StippleParameters).
+    std::function<unsigned()> m_stepThreads;
+    double m_computeScale = DEFAULT_COMPUTE_SCALE;
+    // 0 for the size of the input, a height of 0 keeps its aspect ratio.
+    std::uint32_t m_outputWidth = 0, m_outputHeight = 0;
+    // prints the progress of the relaxation.
+    bool m_verbose = true;
+    std::string m_batchSource;
+    std::string m_outDirectory = DEFAULT_OUT_DIRECTORY;
+    std::string m_serveSocket;
+    std::size_t m_queueDepth = DEFAULT_QUEUE_DEPTH;
+
+   public:
+    std::uint32_t getGeneratorPoints() const { return m_generatorPoints; }
+    std::uint32_t getGeneratorRadius() const { return m_generatorRadius; }
+    std::uint32_t getIterations() const { return m_iterations; }
+    std::uint32_t getSeed() const { return m_seed; }
+    InitMode getInitMode() const { return m_initMode; }
+    std::uint32_t getBandRows() const { return m_bandRows; }
+    Labelling getLabelling() const { return m_labelling; }
+    std::string getInFilename() const { return m_infilename; }
+    std::string getOutFilename() const { return m_outfilename; }
+    bool hasOutFilename() const { return m_hasOutFilename; }
+    std::string getPointsFilename() const { return m_pointsFilename; }
+    std::string getCheckpointFilename() const { return m_checkpointFilename; }
+    std::uint32_t getCheckpointEvery() const { return m_checkpointEvery; }
+    bool getResume() const { return m_resume; }
+    std::uint32_t getEmitEvery() const { return m_emitEvery; }
+    std::string getTraceFilename() const { return m_traceFilename; }
+    bool getMemReport() const { return m_memReport; }
+    std::string getMaskFilename() const { return m_maskFilename; }
+    std::string getCacheDirectory() const { return m_cacheDirectory; }
+    std::size_t getMaxMemory() const { return m_maxMemory; }
+    std::string getTileDirectory() const { return m_tileDirectory; }
+    std::uint32_t getThreads() const { return m_threads; }
+    double getComputeScale() const { return m_computeScale; }
+    std::uint32_t getOutputWidth() const { return m_outputWidth; }
+    std::uint32_t getOutputHeight() const { return m_outputHeight; }
+    bool isVerbose() const { return m_verbose; }
+    std::string getBatchSource() const { return m_batchSource; }
+    std::string getOutDirectory() const { return m_outDirectory; }
+    std::string getServeSocket() const { return m_serveSocket; }
+    std::size_t getQueueDepth() const { return m_queueDepth; }
+    StippleParameters getStippleParameters() const {
+        StippleParameters parameters;
+        parameters.points = m_generatorPoints;
+        parameters.iterations = m_iterations;
+        parameters.seed = m_seed;
+        parameters.initMode = m_initMode;
+        parameters.bandRows = m_bandRows;
+        parameters.cacheDirectory = m_cacheDirectory;
+        parameters.labelling = m_labelling;
+        parameters.threads = m_threads;
+        parameters.stepThreads = m_stepThreads;
+        return parameters;
+    }
+
+    void setGeneratorPoints(std::uint32_t x) { m_generatorPoints = x; }
+    void setGeneratorRadius(std::uint32_t x) { m_generatorRadius = x; }
+    void setIterations(std::uint32_t x) { m_iterations = x; }
+    void setSeed(std::uint32_t x) { m_seed = x; }
+    void setInitMode(InitMode x) { m_initMode = x; }
+    void setBandRows(std::uint32_t x) { m_bandRows = x; }
+    void setLabelling(Labelling x) { m_labelling = x; }
+    void setInFilename(std::string x) { m_infilename = x; }
+    void setOutFilename(std::string x) {
+        m_outfilename = x;
+        m_hasOutFilename = true;
+    }
+    // Neither an image, a point set, a checkpoint nor frames, until set
+    // again.
+    void clearOutputs() {
+        m_outfilename = DEFAULT_OUTFILE;
+        m_hasOutFilename = false;
+        m_pointsFilename.clear();
+        m_checkpointFilename.clear();
+        m_emitEvery = 0;
+    }
+    void setPointsFilename(std::string x) { m_pointsFilename = x; }
+    void setCheckpointFilename(std::string x) { m_checkpointFilename = x; }
+    void setCheckpointEvery(std::uint32_t x) { m_checkpointEvery = x; }
+    void setResume(bool x) { m_resume = x; }
+    void setEmitEvery(std::uint32_t x) { m_emitEvery = x; }
+    void setTraceFilename(std::string x) { m_traceFilename = x; }
+    void setMemReport(bool x) { m_memReport = x; }
+    void setMaskFilename(std::string x) { m_maskFilename = x; }
+    void setCacheDirectory(std::string x) { m_cacheDirectory = x; }
+    void setMaxMemory(std::size_t x) { m_maxMemory = x; }
+    void setTileDirectory(std::string x) { m_tileDirectory = x; }
+    void setThreads(std::uint32_t x) { m_threads = x; }
+    void setStepThreads(std::function<unsigned()> x) { m_stepThreads = x; }
+    void setComputeScale(double x) { m_computeScale = x; }
+    void setOutputWidth(std::uint32_t x) { m_outputWidth = x; }
+    void setOutputHeight(std::uint32_t x) { m_outputHeight = x; }
+    void setVerbose(bool x) { m_verbose = x; }
+    void setBatchSource(std::string x) { m_batchSource = x; }
+    void setOutDirectory(std::string x) { m_outDirectory = x; }
+    void setServeSocket(std::string x) { m_serveSocket = x; }
+    void setQueueDepth(std::size_t x) { m_queueDepth = x; }
+};
+
+struct JobResult {
+    // size of the input.
+    Vector2 native;
+    std::size_t generators;
+};
+
+// Thrown by runJob once `cancelled` is set, at the latest after the next
+// relaxation step.
+struct JobCancelled {};
+
+// Stipples the input of `config` into its output(s). Reuses the buffers of
+// `context` when one is given, else allocates (and frees) its own. Throws
+// like the loaders and writers it calls.
+JobResult runJob(const Config& config, StippleContext* context = nullptr,
+                 const std::atomic<bool>* cancelled = nullptr);
+
+bool hasExtension(const std::string filename, const std::string extension);
+
+#endif  // STIPPLING_JOB_
@@ -0,0 +1,510 @@
+#include "kernels.hpp"
+
+#include <atomic>
+#include <cstring>
+
+// x86-64 only: the label kernels compare size_t labels as 64 bit lanes.
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define STIPPLING_X86_
+// the AVX-512 variants use masked byte and 256 bit operations as well.
+#define STIPPLING_AVX512_ "avx512f,avx512bw,avx512vl"
+#endif
+
+namespace {
+
+// source: https://en.wikipedia.org/wiki/Relative_luminance
+constexpr float LUMA_R = 0.2126f, LUMA_G = 0.7152f, LUMA_B = 0.0722f;
+
+// Every variant evaluates exactly these operations in this order (and
+// without FMA), so they all produce bit identical results.
+inline float darkness(Color color) {
+    float R = (color >> (8 * 0)) & 0xFF, G = (color >> (8 * 1)) & 0xFF,
+          B = (color >> (8 * 2)) & 0xFF;
+
+    float d = 256.0f - ((LUMA_R * R + LUMA_G * G) + LUMA_B * B);
+    d *= d;
+    d *= d;
+    d *= d;
+    return d;
+}
+
+// dst + (src - dst) * alpha / 255 on each color channel, alpha is untouched.
+inline Color blend(Color dst, Color src, std::uint32_t alpha) {
+    Color out = dst & 0xFF000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        std::int32_t d = (dst >> shift) & 0xFF, s = (src >> shift) & 0xFF;
+        d += ((s - d) * (std::int32_t)alpha + 127) / 255;
+        out |= (Color)d << shift;
+    }
+    return out;
+}
+
+// t / 255 for |t| <= 255 * 255 + 127, rounded towards zero as in blend, is
+// (|t| * DIVIDE_255) >> 23 with the sign of t.
+constexpr std::int32_t DIVIDE_255 = 0x8081;
+
+inline bool nearer(std::uint64_t distance, std::size_t id, std::uint64_t best,
+                   std::size_t nearest) {
+    return distance < best || (distance == best && id < nearest);
+}
+
+void rgbaToDarknessScalar(const Color* pixels, float* out, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) out[i] = darkness(pixels[i]);
+}
+
+void columnWeightedScalar(const float* darkness, float* out,
+                          std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) out[i] = darkness[i] * i;
+}
+
+std::size_t labelRunEndScalar(const std::size_t* labels, std::size_t from,
+                              std::size_t to) {
+    std::size_t i = from + 1;
+    while (i < to && labels[i] == labels[from]) ++i;
+    return i;
+}
+
+void nearestGeneratorScalar(const std::int32_t* xs, const std::int32_t* ys,
+                            const std::uint32_t* ids, std::size_t count,
+                            std::int32_t x, std::int32_t y,
+                            std::uint64_t& best, std::size_t& nearest) {
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::int32_t dx = xs[i] - x, dy = ys[i] - y;
+        const std::uint64_t distance = 1ULL * dx * dx + 1ULL * dy * dy;
+        if (nearer(distance, ids[i], best, nearest)) {
+            best = distance;
+            nearest = ids[i];
+        }
+    }
+}
+
+void blendCoverageScalar(Color* row, const std::uint8_t* coverage,
+                         std::size_t count, Color color) {
+    for (std::size_t i = 0; i < count; ++i)
+        if (coverage[i]) row[i] = blend(row[i], color, coverage[i]);
+}
+
+#ifdef STIPPLING_X86_
+
+__attribute__((target("avx2"))) void rgbaToDarknessAVX2(const Color* pixels,
+                                                        float* out,
+                                                        std::size_t count) {
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    const __m256 r = _mm256_set1_ps(LUMA_R), g = _mm256_set1_ps(LUMA_G),
+                 b = _mm256_set1_ps(LUMA_B), max = _mm256_set1_ps(256.0f);
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(pixels + i));
+        __m256 R = _mm256_cvtepi32_ps(_mm256_and_si256(p, mask));
+        __m256 G = _mm256_cvtepi32_ps(
+            _mm256_and_si256(_mm256_srli_epi32(p, 8), mask));
+        __m256 B = _mm256_cvtepi32_ps(
+            _mm256_and_si256(_mm256_srli_epi32(p, 16), mask));
+
+        __m256 lum = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(r, R), _mm256_mul_ps(g, G)),
+            _mm256_mul_ps(b, B));
+        __m256 d = _mm256_sub_ps(max, lum);
+        d = _mm256_mul_ps(d, d);
+        d = _mm256_mul_ps(d, d);
+        d = _mm256_mul_ps(d, d);
+        _mm256_storeu_ps(out + i, d);
+    }
+    rgbaToDarknessScalar(pixels + i, out + i, count - i);
+}
+
+__attribute__((target("avx2"))) void columnWeightedAVX2(const float* darkness,
+                                                        float* out,
+                                                        std::size_t count) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 x = _mm256_cvtepi32_ps(
+            _mm256_add_epi32(_mm256_set1_epi32(i), lanes));
+        _mm256_storeu_ps(out + i,
+                         _mm256_mul_ps(_mm256_loadu_ps(darkness + i), x));
+    }
+    for (; i < count; ++i) out[i] = darkness[i] * i;
+}
+
+__attribute__((target("avx2"))) std::size_t labelRunEndAVX2(
+    const std::size_t* labels, std::size_t from, std::size_t to) {
+    const __m256i label = _mm256_set1_epi64x(labels[from]);
+    std::size_t i = from + 1;
+    for (; i + 4 <= to; i += 4) {
+        const __m256i same = _mm256_cmpeq_epi64(
+            _mm256_loadu_si256((const __m256i*)(labels + i)), label);
+        const int mask = _mm256_movemask_pd(_mm256_castsi256_pd(same));
+        if (mask != 0xF) return i + __builtin_ctz(~mask);
+    }
+    while (i < to && labels[i] == labels[from]) ++i;
+    return i;
+}
+
+__attribute__((target("avx2"))) void nearestGeneratorAVX2(
+    const std::int32_t* xs, const std::int32_t* ys, const std::uint32_t* ids,
+    std::size_t count, std::int32_t x, std::int32_t y, std::uint64_t& best,
+    std::size_t& nearest) {
+    std::size_t i = 0;
+    if (count >= 4) {
+        const __m256i cx = _mm256_set1_epi64x(x), cy = _mm256_set1_epi64x(y);
+        // distances stay below 2^63, so the signed compares are exact.
+        __m256i laneBest = _mm256_set1_epi64x(INT64_MAX),
+                laneId = _mm256_set1_epi64x(INT64_MAX);
+        for (; i + 4 <= count; i += 4) {
+            const __m256i dx = _mm256_sub_epi64(
+                _mm256_cvtepi32_epi64(
+                    _mm_loadu_si128((const __m128i*)(xs + i))),
+                cx);
+            const __m256i dy = _mm256_sub_epi64(
+                _mm256_cvtepi32_epi64(
+                    _mm_loadu_si128((const __m128i*)(ys + i))),
+                cy);
+            const __m256i distance = _mm256_add_epi64(_mm256_mul_epi32(dx, dx),
+                                                      _mm256_mul_epi32(dy, dy));
+            const __m256i id = _mm256_cvtepu32_epi64(
+                _mm_loadu_si128((const __m128i*)(ids + i)));
+
+            const __m256i better = _mm256_or_si256(
+                _mm256_cmpgt_epi64(laneBest, distance),
+                _mm256_and_si256(_mm256_cmpeq_epi64(laneBest, distance),
+                                 _mm256_cmpgt_epi64(laneId, id)));
+            laneBest = _mm256_blendv_epi8(laneBest, distance, better);
+            laneId = _mm256_blendv_epi8(laneId, id, better);
+        }
+
+        std::uint64_t distances[4], lanes[4];
+        _mm256_storeu_si256((__m256i*)distances, laneBest);
+        _mm256_storeu_si256((__m256i*)lanes, laneId);
+        for (int lane = 0; lane < 4; ++lane) {
+            if (nearer(distances[lane], lanes[lane], best, nearest)) {
+                best = distances[lane];
+                nearest = lanes[lane];
+            }
+        }
+    }
+    nearestGeneratorScalar(xs + i, ys + i, ids + i, count - i, x, y, best,
+                           nearest);
+}
+
+// blend of one channel of 8 pixels, as in the scalar blend.
+template <int SHIFT>
+__attribute__((target("avx2"))) inline __m256i blendChannelAVX2(
+    __m256i pixels, __m256i alpha, Color color) {
+    const __m256i d = _mm256_and_si256(_mm256_srli_epi32(pixels, SHIFT),
+                                       _mm256_set1_epi32(0xFF));
+    const __m256i s = _mm256_set1_epi32((color >> SHIFT) & 0xFF);
+    const __m256i t = _mm256_add_epi32(
+        _mm256_mullo_epi32(_mm256_sub_epi32(s, d), alpha),
+        _mm256_set1_epi32(127));
+    const __m256i q = _mm256_sign_epi32(
+        _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_abs_epi32(t),
+                                             _mm256_set1_epi32(DIVIDE_255)),
+                          23),
+        t);
+    return _mm256_slli_epi32(_mm256_add_epi32(d, q), SHIFT);
+}
+
+__attribute__((target("avx2"))) inline __m256i blend8AVX2(__m256i pixels,
+                                                          __m256i alpha,
+                                                          Color color) {
+    __m256i out = _mm256_and_si256(pixels, _mm256_set1_epi32(0xFF000000));
+    out = _mm256_or_si256(out, blendChannelAVX2<0>(pixels, alpha, color));
+    out = _mm256_or_si256(out, blendChannelAVX2<8>(pixels, alpha, color));
+    return _mm256_or_si256(out, blendChannelAVX2<16>(pixels, alpha, color));
+}
+
+__attribute__((target("avx2"))) void blendCoverageAVX2(
+    Color* row, const std::uint8_t* coverage, std::size_t count,
+    Color color) {
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i alpha = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i*)(coverage + i)));
+        __m256i* pixels = (__m256i*)(row + i);
+        _mm256_storeu_si256(
+            pixels, blend8AVX2(_mm256_loadu_si256(pixels), alpha, color));
+    }
+    if (i == count) return;
+
+    // the dots are mostly narrower than 8 pixels.
+    std::uint8_t tail[8] = {};
+    std::memcpy(tail, coverage + i, count - i);
+    const __m256i alpha = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)tail));
+    const __m256i mask = _mm256_cmpgt_epi32(
+        _mm256_set1_epi32(count - i),
+        _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    int* pixels = (int*)(row + i);
+    _mm256_maskstore_epi32(
+        pixels, mask,
+        blend8AVX2(_mm256_maskload_epi32(pixels, mask), alpha, color));
+}
+
+// the AVX-512 intrinsics start from _mm512_undefined_*, which GCC 12 takes
+// for a read of an uninitialized variable.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target(STIPPLING_AVX512_))) void rgbaToDarknessAVX512(
+    const Color* pixels, float* out, std::size_t count) {
+    const __m512i mask = _mm512_set1_epi32(0xFF);
+    const __m512 r = _mm512_set1_ps(LUMA_R), g = _mm512_set1_ps(LUMA_G),
+                 b = _mm512_set1_ps(LUMA_B), max = _mm512_set1_ps(256.0f);
+
+    for (std::size_t i = 0; i < count; i += 16) {
+        const __mmask16 lanes =
+            count - i >= 16 ? 0xFFFF : (__mmask16)((1u << (count - i)) - 1);
+        __m512i p = _mm512_maskz_loadu_epi32(lanes, pixels + i);
+        __m512 R = _mm512_cvtepi32_ps(_mm512_and_si512(p, mask));
+        __m512 G = _mm512_cvtepi32_ps(
+            _mm512_and_si512(_mm512_srli_epi32(p, 8), mask));
+        __m512 B = _mm512_cvtepi32_ps(
+            _mm512_and_si512(_mm512_srli_epi32(p, 16), mask));
+
+        __m512 lum = _mm512_add_ps(
+            _mm512_add_ps(_mm512_mul_ps(r, R), _mm512_mul_ps(g, G)),
+            _mm512_mul_ps(b, B));
+        __m512 d = _mm512_sub_ps(max, lum);
+        d = _mm512_mul_ps(d, d);
+        d = _mm512_mul_ps(d, d);
+        d = _mm512_mul_ps(d, d);
+        _mm512_mask_storeu_ps(out + i, lanes, d);
+    }
+}
+
+__attribute__((target(STIPPLING_AVX512_))) void columnWeightedAVX512(
+    const float* darkness, float* out, std::size_t count) {
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                            11, 12, 13, 14, 15);
+    for (std::size_t i = 0; i < count; i += 16) {
+        const __mmask16 mask =
+            count - i >= 16 ? 0xFFFF : (__mmask16)((1u << (count - i)) - 1);
+        const __m512 x = _mm512_cvtepi32_ps(
+            _mm512_add_epi32(_mm512_set1_epi32(i), lanes));
+        _mm512_mask_storeu_ps(
+            out + i, mask,
+            _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, darkness + i), x));
+    }
+}
+
+__attribute__((target(STIPPLING_AVX512_))) std::size_t labelRunEndAVX512(
+    const std::size_t* labels, std::size_t from, std::size_t to) {
+    const __m512i label = _mm512_set1_epi64(labels[from]);
+    for (std::size_t i = from + 1; i < to; i += 8) {
+        const __mmask8 mask =
+            to - i >= 8 ? 0xFF : (__mmask8)((1u << (to - i)) - 1);
+        const __mmask8 other = _mm512_mask_cmpneq_epi64_mask(
+            mask, _mm512_maskz_loadu_epi64(mask, labels + i), label);
+        if (other) return i + __builtin_ctz(other);
+    }
+    return to;
+}
+
+__attribute__((target(STIPPLING_AVX512_))) void nearestGeneratorAVX512(
+    const std::int32_t* xs, const std::int32_t* ys, const std::uint32_t* ids,
+    std::size_t count, std::int32_t x, std::int32_t y, std::uint64_t& best,
+    std::size_t& nearest) {
+    if (!count) return;
+    const __m512i cx = _mm512_set1_epi64(x), cy = _mm512_set1_epi64(y);
+    // distances stay below 2^63, so the signed compares are exact.
+    __m512i laneBest = _mm512_set1_epi64(INT64_MAX),
+            laneId = _mm512_set1_epi64(INT64_MAX);
+    for (std::size_t i = 0; i < count; i += 8) {
+        const __mmask8 mask =
+            count - i >= 8 ? 0xFF : (__mmask8)((1u << (count - i)) - 1);
+        const __m512i dx = _mm512_sub_epi64(
+            _mm512_cvtepi32_epi64(_mm256_maskz_loadu_epi32(mask, xs + i)), cx);
+        const __m512i dy = _mm512_sub_epi64(
+            _mm512_cvtepi32_epi64(_mm256_maskz_loadu_epi32(mask, ys + i)), cy);
+        const __m512i distance = _mm512_add_epi64(_mm512_mul_epi32(dx, dx),
+                                                  _mm512_mul_epi32(dy, dy));
+        const __m512i id =
+            _mm512_cvtepu32_epi64(_mm256_maskz_loadu_epi32(mask, ids + i));
+
+        const __mmask8 better =
+            mask & (_mm512_cmplt_epi64_mask(distance, laneBest) |
+                    (_mm512_cmpeq_epi64_mask(distance, laneBest) &
+                     _mm512_cmplt_epi64_mask(id, laneId)));
+        laneBest = _mm512_mask_mov_epi64(laneBest, better, distance);
+        laneId = _mm512_mask_mov_epi64(laneId, better, id);
+    }
+
+    std::uint64_t distances[8], lanes[8];
+    _mm512_storeu_si512(distances, laneBest);
+    _mm512_storeu_si512(lanes, laneId);
+    for (int lane = 0; lane < 8; ++lane) {
+        if (nearer(distances[lane], lanes[lane], best, nearest)) {
+            best = distances[lane];
+            nearest = lanes[lane];
+        }
+    }
+}
+
+// blend of one channel of 16 pixels, as in the scalar blend.
+template <int SHIFT>
+__attribute__((target(STIPPLING_AVX512_))) inline __m512i blendChannelAVX512(
+    __m512i pixels, __m512i alpha, Color color) {
+    const __m512i d = _mm512_and_si512(_mm512_srli_epi32(pixels, SHIFT),
+                                       _mm512_set1_epi32(0xFF));
+    const __m512i s = _mm512_set1_epi32((color >> SHIFT) & 0xFF);
+    const __m512i t = _mm512_add_epi32(
+        _mm512_mullo_epi32(_mm512_sub_epi32(s, d), alpha),
+        _mm512_set1_epi32(127));
+    __m512i q = _mm512_srli_epi32(
+        _mm512_mullo_epi32(_mm512_abs_epi32(t), _mm512_set1_epi32(DIVIDE_255)),
+        23);
+    const __m512i zero = _mm512_setzero_si512();
+    q = _mm512_mask_sub_epi32(q, _mm512_cmplt_epi32_mask(t, zero), zero, q);
+    return _mm512_slli_epi32(_mm512_add_epi32(d, q), SHIFT);
+}
+
+__attribute__((target(STIPPLING_AVX512_))) void blendCoverageAVX512(
+    Color* row, const std::uint8_t* coverage, std::size_t count,
+    Color color) {
+    for (std::size_t i = 0; i < count; i += 16) {
+        const __mmask16 mask =
+            count - i >= 16 ? 0xFFFF : (__mmask16)((1u << (count - i)) - 1);
+        const __m512i alpha =
+            _mm512_cvtepu8_epi32(_mm_maskz_loadu_epi8(mask, coverage + i));
+        const __m512i pixels = _mm512_maskz_loadu_epi32(mask, row + i);
+
+        __m512i out =
+            _mm512_and_si512(pixels, _mm512_set1_epi32(0xFF000000));
+        out = _mm512_or_si512(out, blendChannelAVX512<0>(pixels, alpha, color));
+        out = _mm512_or_si512(out, blendChannelAVX512<8>(pixels, alpha, color));
+        out =
+            _mm512_or_si512(out, blendChannelAVX512<16>(pixels, alpha, color));
+        _mm512_mask_storeu_epi32(row + i, mask, out);
+    }
+}
+
+#pragma GCC diagnostic pop
+
+#endif  // STIPPLING_X86_
+
+struct KernelTable {
+    void (*rgbaToDarkness)(const Color*, float*, std::size_t);
+    void (*columnWeighted)(const float*, float*, std::size_t);
+    std::size_t (*labelRunEnd)(const std::size_t*, std::size_t, std::size_t);
+    void (*nearestGenerator)(const std::int32_t*, const std::int32_t*,
+                             const std::uint32_t*, std::size_t, std::int32_t,
+                             std::int32_t, std::uint64_t&, std::size_t&);
+    void (*blendCoverage)(Color*, const std::uint8_t*, std::size_t, Color);
+};
+
+const KernelTable SCALAR{rgbaToDarknessScalar, columnWeightedScalar,
+                         labelRunEndScalar, nearestGeneratorScalar,
+                         blendCoverageScalar};
+#ifdef STIPPLING_X86_
+const KernelTable AVX2{rgbaToDarknessAVX2, columnWeightedAVX2,
+                       labelRunEndAVX2, nearestGeneratorAVX2,
+                       blendCoverageAVX2};
+const KernelTable AVX512{rgbaToDarknessAVX512, columnWeightedAVX512,
+                         labelRunEndAVX512, nearestGeneratorAVX512,
+                         blendCoverageAVX512};
+#endif
+
+const KernelTable& table(CpuLevel level) {
+#ifdef STIPPLING_X86_
+    if (level == CpuLevel::AVX512) return AVX512;
+    if (level == CpuLevel::AVX2) return AVX2;
+#endif
+    (void)level;
+    return SCALAR;
+}
+
+std::atomic<const KernelTable*> active{nullptr};
+
+const KernelTable& kernels() {
+    const KernelTable* kernels = active.load(std::memory_order_relaxed);
+    if (kernels) return *kernels;
+    kernels = &table(detectCpuLevel());
+    active.store(kernels, std::memory_order_relaxed);
+    return *kernels;
+}
+
+const char* const LEVEL_NAMES[] = {"scalar", "avx2", "avx512"};
+
+}  // namespace
+
+CpuLevel detectCpuLevel() {
+#ifdef STIPPLING_X86_
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl"))
+        return CpuLevel::AVX512;
+    if (__builtin_cpu_supports("avx2")) return CpuLevel::AVX2;
+#endif
+    return CpuLevel::Scalar;
+}
+
+CpuLevel getCpuLevel() {
+    const KernelTable* current = &kernels();
+#ifdef STIPPLING_X86_
+    if (current == &AVX512) return CpuLevel::AVX512;
+    if (current == &AVX2) return CpuLevel::AVX2;
+#endif
+    (void)current;
+    return CpuLevel::Scalar;
+}
+
+void setCpuLevel(CpuLevel level) {
+    if (level > detectCpuLevel())
+        throw "The CPU does not support this instruction set.\n";
+    active.store(&table(level), std::memory_order_relaxed);
+}
+
+const char* cpuLevelName(CpuLevel level) {
+    return LEVEL_NAMES[(int)level];
+}
+
+bool parseCpuLevel(const std::string name, CpuLevel& level) {
+    for (int i = 0; i < 3; ++i) {
+        if (name == LEVEL_NAMES[i]) {
+            level = (CpuLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void rgbaToDarkness(const Color* pixels, float* darkness, std::size_t count) {
+    kernels().rgbaToDarkness(pixels, darkness, count);
+}
+
+void lumaToDarkness(const std::uint8_t* luma, float* out, std::size_t count) {
+    // a gray pixel has R = G = B, the weights add up to 1.
+    static const struct Table {
+        float values[256];
+        Table() {
+            for (Color v = 0; v < 256; ++v)
+                values[v] = darkness(BLACK | v * 0x010101);
+        }
+    } table;
+
+    for (std::size_t i = 0; i < count; ++i) out[i] = table.values[luma[i]];
+}
+
+void columnWeighted(const float* darkness, float* weighted,
+                    std::size_t count) {
+    kernels().columnWeighted(darkness, weighted, count);
+}
+
+std::size_t labelRunEnd(const std::size_t* labels, std::size_t from,
+                        std::size_t to) {
+    return kernels().labelRunEnd(labels, from, to);
+}
+
+void nearestGenerator(const std::int32_t* xs, const std::int32_t* ys,
+                      const std::uint32_t* ids, std::size_t count,
+                      std::int32_t x, std::int32_t y, std::uint64_t& best,
+                      std::size_t& nearest) {
+    kernels().nearestGenerator(xs, ys, ids, count, x, y, best, nearest);
+}
+
+void blendCoverage(Color* row, const std::uint8_t* coverage,
+                   std::size_t count, Color color) {
+    kernels().blendCoverage(row, coverage, count, color);
+}
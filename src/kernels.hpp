@@ -0,0 +1,54 @@
+#ifndef STIPPLING_KERNELS_
+#define STIPPLING_KERNELS_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "image.hpp"
+
+// Instruction sets the kernels below have variants for. Every variant gives
+// bit identical results, so the level never changes a stipple. The best
+// level the CPU supports is picked on first use.
+enum class CpuLevel { Scalar, AVX2, AVX512 };
+
+CpuLevel detectCpuLevel();
+CpuLevel getCpuLevel();
+// Overrides the detected level (--cpu). Throws if the CPU lacks `level`.
+void setCpuLevel(CpuLevel level);
+
+const char* cpuLevelName(CpuLevel level);
+// Returns false if `name` is not one of the cpuLevelName.
+bool parseCpuLevel(const std::string name, CpuLevel& level);
+
+// Darkness (see Image::getDarkness) of `count` RGBA pixels, in single
+// precision.
+void rgbaToDarkness(const Color* pixels, float* darkness, std::size_t count);
+
+// Darkness of `count` 8 bit luma values.
+void lumaToDarkness(const std::uint8_t* luma, float* darkness,
+                    std::size_t count);
+
+// darkness[x] * x for the `count` pixels of a row, as the x moment of the
+// prefix functions takes it.
+void columnWeighted(const float* darkness, float* weighted, std::size_t count);
+
+// End of the run of equal labels starting at `from`: the first index in
+// (from, to) with another label, else `to`.
+std::size_t labelRunEnd(const std::size_t* labels, std::size_t from,
+                        std::size_t to);
+
+// Updates `best` (squared distance) and `nearest` with the `count`
+// generators (xs, ys) nearer to (x, y), by their `ids`; the lowest id wins
+// a tie.
+void nearestGenerator(const std::int32_t* xs, const std::int32_t* ys,
+                      const std::uint32_t* ids, std::size_t count,
+                      std::int32_t x, std::int32_t y, std::uint64_t& best,
+                      std::size_t& nearest);
+
+// Blends `color` over the `count` pixels of `row` with the matching 0 to
+// 255 `coverage`; the alpha of the pixels is untouched.
+void blendCoverage(Color* row, const std::uint8_t* coverage,
+                   std::size_t count, Color color);
+
+#endif  // STIPPLING_KERNELS_
@@ -1,112 +1,116 @@
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <string>
 #include <vector>
 
-#include "Vector2.hpp"
-#include "image.hpp"
-#include "voronoi.hpp"
+#include "batch.hpp"
+#include "job.hpp"
+#include "kernels.hpp"
+#include "memory.hpp"
+#include "server.hpp"
+#include "stipple.hpp"
+#include "trace.hpp"
 
 #define CONSUME(argc, argv) if (argc) argc--; argv += 1
 
-constexpr std::uint32_t DEFAULT_GENERATOR_POINTS = 10000;
-constexpr std::uint32_t DEFAULT_GENERATOR_RADIUS = 1;
-constexpr std::uint32_t DEFAULT_ITERATIONS = 10;
-constexpr std::uint32_t DEFAULT_SEED = 420;
-constexpr const char* DEFAULT_INFILE = "./example/butterfly.png";
-constexpr const char* DEFAULT_OUTFILE = "./photo.png";
-
-class Config {
-   private:
-    inline static Config* instance = nullptr;
-    Config() = default;
-    ~Config() = default;
-
-    std::uint32_t m_generatorPoints = DEFAULT_GENERATOR_POINTS;
-    std::uint32_t m_generatorRadius = DEFAULT_GENERATOR_RADIUS;
-    std::uint32_t m_iterations = DEFAULT_ITERATIONS;
-    std::uint32_t m_seed = DEFAULT_SEED;
-    std::string m_infilename = DEFAULT_INFILE;
-    std::string m_outfilename = DEFAULT_OUTFILE;
-
-   public:
-    static Config* getInstance() {
-        if (instance == nullptr) instance = new Config();
-        return instance;
-    }
-
-    std::uint32_t getGeneratorPoints() const { return m_generatorPoints; }
-    std::uint32_t getGeneratorRadius() const { return m_generatorRadius; }
-    std::uint32_t getIterations() const { return m_iterations; }
-    std::uint32_t getSeed() const { return m_seed; }
-    std::string getInFilename() const { return m_infilename; }
-    std::string getOutFilename() const { return m_outfilename; }
-
-    void setGeneratorPoints(std::uint32_t x) { m_generatorPoints = x; }
-    void setGeneratorRadius(std::uint32_t x) { m_generatorRadius = x; }
-    void setIterations(std::uint32_t x) { m_iterations = x; }
-    void setSeed(std::uint32_t x) { m_seed = x; }
-    void setInFilename(std::string x) { m_infilename = x; }
-    void setOutFilename(std::string x) { m_outfilename = x; }
-};
-
-void stippleAndSave(Image& img, const std::string filename) {
-    const Config* config = Config::getInstance();
-
-    std::pair<PrefixFunction, PrefixFunction> prefixFunctions =
-        img.computePrefixFunctions();
-
-    std::vector<Vector2> generators =
-        rejectionSampling(config->getGeneratorPoints(), img);
-
-    img.fillByColor(WHITE);
-
-    for (std::size_t i = 0; i < config->getIterations(); ++i) {
-        std::cout << "ITERATION: " << i + 1 << '\n';
-        std::vector<VoronoiBoundary> boundaries = getVoronoiBoundaries(img, generators);
-        generators = computeVoronoiCenters(boundaries, prefixFunctions);
-    }
-
-    for (auto& generator : generators)
-        img.fillCircle(generator, config->getGeneratorRadius(), 0xFF181818);
-
-    img.saveAsPNG(filename);
-}
-
-[[maybe_unused]]
-void threeCircleImage() {
-    static constexpr std::uint32_t FACTOR = 100;
-    static constexpr std::uint32_t WIDTH = 16 * FACTOR;
-    static constexpr std::uint32_t HEIGHT = 9 * FACTOR;
-
-    Image img(WIDTH, HEIGHT);
-    Vector2 dimensions(WIDTH, HEIGHT);
-
-    img.fillByColor(WHITE);
-    img.fillCircle(dimensions / 2, HEIGHT / 6, BLACK);
-    img.fillCircle(dimensions / 2 - dimensions / 3, HEIGHT / 6, BLACK);
-    img.fillCircle(dimensions / 2 + dimensions / 3, HEIGHT / 6, BLACK);
-
-    stippleAndSave(img, "photo.png");
-}
-
 inline void usage() {
     std::cout << "Usage: \n" <<
                  "        $ ./stipple [-it|--iterations NUMBER] [-p|--points NUMBER]" <<
-                 " [-i|--infile FILE] [-o|--outfile FILE] [-r|--radius PIXEL] [-s|--seed NUMBER]\n" << 
+                 " [-i|--infile FILE] [-o|--outfile FILE] [-r|--radius PIXEL] [-s|--seed NUMBER]\n" <<
+                 "          [-m|--init MODE] [--labelling MODE] [--band-rows NUMBER] [--cache DIR]\n" <<
+                 "          [--max-memory MB] [--tile-dir DIR] [-t|--threads NUMBER]\n" <<
+                 "          [--compute-scale SCALE] [--output-size WIDTHxHEIGHT] [--mask FILE] [--points-out FILE]\n" <<
+                 "          [--checkpoint FILE] [--checkpoint-every NUMBER] [--resume] [--emit-every NUMBER]\n" <<
+                 "          [--trace FILE] [--batch SOURCE [--out-dir DIR] | --serve PATH [--queue-depth NUMBER]]\n" <<
+                 "          [--cpu LEVEL] [--mem-report]\n" << 
                  "\n" <<
                  " -it, --iterations : Number of iterations for which relaxation step takes place.\n" <<
                  "                     Default: " << DEFAULT_ITERATIONS << '\n' << 
                  " -p, --points      : Number of voronoi generator points.\n" << 
                  "                     Default: " << DEFAULT_GENERATOR_POINTS << '\n' << 
-                 " -i, --infile      : Input file which is 3 or 4 component png file.\n" <<
+                 " -i, --infile      : Input file which is 3 or 4 component png file, or a binary pgm/ppm.\n" <<
                  "                     Default: " << DEFAULT_INFILE << '\n' << 
-                 " -o, --outfile     : Output file where the output png is stored.\n" <<
+                 " -o, --outfile     : Output file, stored as svg/eps/pdf/pgm/ppm by extension, png otherwise.\n" <<
                  "                     Default: " << DEFAULT_OUTFILE << '\n' << 
                  " -r, --radius      : Radius of the each generator point in pixels.\n" << 
                  "                     Default: " << DEFAULT_GENERATOR_RADIUS << '\n' << 
                  " -s, --seed        : Seed for the PRNG.\n" <<
-                 "                     Default: " << DEFAULT_SEED << "\n\n";
+                 "                     Default: " << DEFAULT_SEED << '\n' <<
+                 " -m, --init        : Initial distribution of the generator points.\n" <<
+                 "                     uniform   : uniformly random over the image.\n" <<
+                 "                     rejection : rejection sampling of the pixel darkness.\n" <<
+                 "                     r2        : R2 low-discrepancy sequence warped through the darkness.\n" <<
+                 "                     diffusion : Floyd-Steinberg error diffusion of the darkness.\n" <<
+                 "                     streaming : sampling of the darkness one band of rows at a time\n" <<
+                 "                                 (only bounds the memory with --max-memory).\n" <<
+                 "                     Default: " << DEFAULT_INIT_MODE << '\n' <<
+                 " --labelling       : How the pixels are split into the cells of the points.\n" <<
+                 "                     flood   : flood fill from the points, nearest first; single\n" <<
+                 "                               threaded, a cell never crosses a gap of the --mask.\n" <<
+                 "                     nearest : every pixel to its nearest point (as --max-memory\n" <<
+                 "                               always labels), in bands of rows on -t threads.\n" <<
+                 "                     Default: " << DEFAULT_LABELLING << '\n' <<
+                 " --band-rows       : Rows per band read by the streaming initialisation.\n" <<
+                 "                     Default: " << DEFAULT_BAND_ROWS << '\n' <<
+                 " --cache           : Directory caching the initial generator points between runs.\n" <<
+                 "                     Default: disabled\n" <<
+                 " --max-memory      : Keep the darkness out-of-core in tiles, with at most this many MB\n" <<
+                 "                     of tiles resident. Always uses the streaming initialisation.\n" <<
+                 "                     Default: disabled\n" <<
+                 " --tile-dir        : Directory of the (deleted on exit) tile file.\n" <<
+                 "                     Default: " << DEFAULT_TILE_DIRECTORY << '\n' <<
+                 " -t, --threads     : Threads rendering the stipples and encoding the png output, and\n" <<
+                 "                     with --labelling nearest, labelling the cells and their centroids.\n" <<
+                 "                     Default: " << DEFAULT_THREADS << '\n' <<
+                 " --compute-scale   : Scale of the grid the stipple is computed on, relative to the input.\n" <<
+                 "                     Default: " << DEFAULT_COMPUTE_SCALE << '\n' <<
+                 " --output-size     : WIDTHxHEIGHT (or WIDTH, keeping the aspect ratio) of the output;\n" <<
+                 "                     the radius is in output pixels.\n" <<
+                 "                     Default: the size of the input\n" <<
+                 " --mask            : Image whose light, opaque pixels are the only ones stippled.\n" <<
+                 "                     Default: the opaque pixels of the input\n" <<
+                 " --points-out      : Also write the stipples as a binary point set (see pointset.hpp);\n" <<
+                 "                     the image is then only written if -o is given.\n" <<
+                 "                     Default: disabled\n" <<
+                 " --checkpoint      : Save the relaxation to this file every --checkpoint-every iterations\n" <<
+                 "                     and after the last, from a background thread (in batches: one\n" <<
+                 "                     .ckpt file per input in --out-dir).\n" <<
+                 "                     Default: disabled\n" <<
+                 " --checkpoint-every: Iterations between two checkpoints.\n" <<
+                 "                     Default: " << DEFAULT_CHECKPOINT_EVERY << '\n' <<
+                 " --resume          : Carry on from the --checkpoint file when there is one, instead of\n" <<
+                 "                     from a new initialisation; -it is the total number of iterations.\n" <<
+                 "                     Default: disabled\n" <<
+                 " --emit-every      : Also save every K-th iteration as a frame named after -o, e.g.\n" <<
+                 "                     photo.0005.png, rendered on a background thread while the\n" <<
+                 "                     relaxation carries on (a frame still waiting is replaced).\n" <<
+                 "                     Default: disabled\n" <<
+                 " --trace           : Write the time spent in each phase, per thread, as Chrome trace\n" <<
+                 "                     events (chrome://tracing, ui.perfetto.dev).\n" <<
+                 "                     Default: disabled\n" <<
+                 " --batch           : Stipple many images: a directory, a quoted glob pattern, or a file\n" <<
+                 "                     listing one input per line ('-' for stdin). The images run side by\n" <<
+                 "                     side on a thread each, largest first; with --labelling nearest,\n" <<
+                 "                     the last ones label on the threads the finished ones left.\n" <<
+                 "                     Default: disabled\n" <<
+                 " --out-dir         : Directory of the batch outputs, named after their inputs with the\n" <<
+                 "                     extension of -o (or .png), and .stps for --points-out.\n" <<
+                 "                     Default: " << DEFAULT_OUT_DIRECTORY << '\n' <<
+                 " --serve           : Serve jobs on this unix domain socket ('-' for stdin/stdout), on\n" <<
+                 "                     -t threads, with the other options as their defaults; see\n" <<
+                 "                     server.hpp for the protocol.\n" <<
+                 "                     Default: disabled\n" <<
+                 " --queue-depth     : Jobs the server queues before it stops reading its clients.\n" <<
+                 "                     Default: " << DEFAULT_QUEUE_DEPTH << '\n' <<
+                 " --cpu             : Instruction set of the hot kernels: scalar, avx2 or avx512. The\n" <<
+                 "                     stipples are the same on every level.\n" <<
+                 "                     Default: the best the CPU supports (" << cpuLevelName(detectCpuLevel()) << ")\n" <<
+                 " --mem-report      : Print the peak bytes of every large buffer, by subsystem, and the\n" <<
+                 "                     peak RSS of every phase and iteration; with --batch or --serve,\n" <<
+                 "                     only on -t 1, the jobs in turn.\n" <<
+                 "                     Default: disabled\n\n";
 }
 
 std::int32_t parseInt(char* argument) {
@@ -119,10 +123,60 @@ std::int32_t parseInt(char* argument) {
     }
 }
 
-void parseArguments(int argc, char** argv)  {
+double parseDouble(char* argument) {
+    std::string arg = argument;
+    try {
+        return std::stod(arg);
+    } catch(...) {
+        std::cerr << "ERROR: could not parse: '" << arg << "' to number.\n";
+        exit(1);
+    }
+}
+
+// WIDTHxHEIGHT, or WIDTH alone with a height of 0.
+std::pair<std::int32_t, std::int32_t> parseSize(char* argument) {
+    std::string arg = argument;
+    try {
+        std::size_t end;
+        std::int32_t width = std::stoi(arg, &end), height = 0;
+        if (end < arg.size()) {
+            if (arg[end] != 'x') throw 0;
+            std::size_t rest;
+            height = std::stoi(arg.substr(end + 1), &rest);
+            if (end + 1 + rest != arg.size() || height <= 0) throw 0;
+        }
+        if (width <= 0) throw 0;
+        return {width, height};
+    } catch(...) {
+        std::cerr << "ERROR: could not parse: '" << arg << "' to a size.\n";
+        exit(1);
+    }
+}
+
+InitMode parseInitMode(char* argument) {
+    std::string arg = argument;
+    if (arg == "uniform") return InitMode::Uniform;
+    if (arg == "rejection") return InitMode::Rejection;
+    if (arg == "r2") return InitMode::LowDiscrepancy;
+    if (arg == "diffusion") return InitMode::ErrorDiffusion;
+    if (arg == "streaming") return InitMode::Streaming;
+
+    std::cerr << "ERROR: unknown initialisation mode: '" << arg << "'.\n";
+    exit(1);
+}
+
+Labelling parseLabelling(char* argument) {
+    std::string arg = argument;
+    if (arg == "flood") return Labelling::Flood;
+    if (arg == "nearest") return Labelling::Nearest;
+
+    std::cerr << "ERROR: unknown labelling: '" << arg << "'.\n";
+    exit(1);
+}
+
+void parseArguments(int argc, char** argv, Config& config)  {
     CONSUME(argc, argv); // consume the executable name.
 
-    Config* config = Config::getInstance();
     while (argc) {
         std::string argument = argv[0];
         if (argument == "-h" || argument == "--help" ) {
@@ -131,40 +185,166 @@ void parseArguments(int argc, char** argv)  {
         } else if (argument == "-it" || argument == "--iterations") {
             CONSUME(argc, argv);
             if (!argc) { usage(); exit(1); }
-            config->setIterations(parseInt(argv[0]));
+            config.setIterations(parseInt(argv[0]));
         } else if (argument == "-p" || argument == "--points") {
             CONSUME(argc, argv);
             if (!argc) { usage(); exit(1); }
-            config->setGeneratorPoints(parseInt(argv[0]));
+            config.setGeneratorPoints(parseInt(argv[0]));
         } else if (argument == "-i" || argument == "--infile") {
             CONSUME(argc, argv);
             if (!argc) { usage(); exit(1); }
-            config->setInFilename(argv[0]);
+            config.setInFilename(argv[0]);
         } else if (argument == "-o" || argument == "--outfile") {
             CONSUME(argc, argv);
             if (!argc) { usage(); exit(1); }
-            config->setOutFilename(argv[0]);
+            config.setOutFilename(argv[0]);
         } else if (argument == "-r" || argument == "--radius") {
             CONSUME(argc, argv);
             if (!argc) { usage(); exit(1); }
-            config->setGeneratorRadius(parseInt(argv[0]));
+            config.setGeneratorRadius(parseInt(argv[0]));
         } else if (argument == "-s" || argument == "--seed") {
             CONSUME(argc, argv);
             if (!argc) { usage(); exit(1); }
-            config->setSeed(parseInt(argv[0]));
+            config.setSeed(parseInt(argv[0]));
+        } else if (argument == "-m" || argument == "--init") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setInitMode(parseInitMode(argv[0]));
+        } else if (argument == "--labelling") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setLabelling(parseLabelling(argv[0]));
+        } else if (argument == "--band-rows") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setBandRows(parseInt(argv[0]));
+        } else if (argument == "--cache") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setCacheDirectory(argv[0]);
+        } else if (argument == "--max-memory") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            const std::int32_t megabytes = parseInt(argv[0]);
+            if (megabytes <= 0) {
+                std::cerr << "ERROR: the memory budget must be positive.\n";
+                exit(1);
+            }
+            config.setMaxMemory((std::size_t)megabytes << 20);
+        } else if (argument == "--tile-dir") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setTileDirectory(argv[0]);
+        } else if (argument == "-t" || argument == "--threads") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setThreads(std::max(1, parseInt(argv[0])));
+        } else if (argument == "--mask") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setMaskFilename(argv[0]);
+        } else if (argument == "--points-out") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setPointsFilename(argv[0]);
+        } else if (argument == "--checkpoint") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setCheckpointFilename(argv[0]);
+        } else if (argument == "--checkpoint-every") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setCheckpointEvery(std::max(1, parseInt(argv[0])));
+        } else if (argument == "--resume") {
+            config.setResume(true);
+        } else if (argument == "--emit-every") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setEmitEvery(std::max(0, parseInt(argv[0])));
+        } else if (argument == "--trace") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setTraceFilename(argv[0]);
+        } else if (argument == "--batch") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setBatchSource(argv[0]);
+        } else if (argument == "--out-dir") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setOutDirectory(argv[0]);
+        } else if (argument == "--serve") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setServeSocket(argv[0]);
+        } else if (argument == "--queue-depth") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            config.setQueueDepth(std::max(1, parseInt(argv[0])));
+        } else if (argument == "--cpu") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            CpuLevel level;
+            if (!parseCpuLevel(argv[0], level)) { usage(); exit(1); }
+            if (level > detectCpuLevel()) {
+                std::cerr << "ERROR: this CPU does not support " << argv[0] << ".\n";
+                exit(1);
+            }
+            setCpuLevel(level);
+        } else if (argument == "--mem-report") {
+            config.setMemReport(true);
+        } else if (argument == "--compute-scale") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            const double scale = parseDouble(argv[0]);
+            if (!(scale > 0)) {
+                std::cerr << "ERROR: the compute scale must be positive.\n";
+                exit(1);
+            }
+            config.setComputeScale(scale);
+        } else if (argument == "--output-size") {
+            CONSUME(argc, argv);
+            if (!argc) { usage(); exit(1); }
+            const auto size = parseSize(argv[0]);
+            config.setOutputWidth(size.first);
+            config.setOutputHeight(size.second);
         }
         CONSUME(argc, argv);
     }
 }
 
+// The subsystem peaks and the peak RSS of --mem-report are those of the
+// whole process, so the phases of jobs running side by side, and their
+// peaks, could not be told apart.
+void checkMemReport(const Config& config, std::size_t concurrentJobs) {
+    if (config.getMemReport() && concurrentJobs > 1) {
+        std::cerr << "ERROR: --mem-report needs one job at a time, i.e. -t 1 with --batch or --serve.\n";
+        exit(1);
+    }
+}
+
 int main(int argc, char** argv) {
-    parseArguments(argc, argv);
+    Config config;
+    parseArguments(argc, argv, config);
 
-    Config* config = Config::getInstance();
-    srand(config->getSeed());
+    if (!config.getTraceFilename().empty()) Tracer::enable();
+    if (config.getMemReport()) MemoryAccounting::enable();
 
-    Image img = Image::from(config->getInFilename());
-    stippleAndSave(img, config->getOutFilename());
+    std::size_t failed = 0;
+    if (!config.getServeSocket().empty()) {
+        checkMemReport(config, config.getThreads());
+        serve(config, config.getServeSocket(), config.getQueueDepth());
+    } else if (!config.getBatchSource().empty()) {
+        const std::vector<std::string> inputs =
+            batchInputs(config.getBatchSource());
+        checkMemReport(config, std::min<std::size_t>(config.getThreads(),
+                                                     inputs.size()));
+        failed = runBatch(config, inputs);
+    } else {
+        runJob(config);
+    }
 
-    return 0;
+    if (Tracer::isEnabled()) Tracer::write(config.getTraceFilename());
+    if (config.getMemReport()) MemoryAccounting::report(std::cout);
+    return failed ? 1 : 0;
 }
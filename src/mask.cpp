@@ -0,0 +1,90 @@
+#include "mask.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+DomainMask DomainMask::fromAlpha(const Image& img) {
+    const Color* pixels = img.getPixels();
+    const size_t width = img.getWidth();
+    return DomainMask(width, img.getHeight(), [&](size_t x, size_t y) {
+        return (pixels[y * width + x] >> 24) != 0;
+    });
+}
+
+DomainMask DomainMask::fromImage(const Image& img) {
+    const Color* pixels = img.getPixels();
+    const size_t width = img.getWidth();
+    return DomainMask(width, img.getHeight(), [&](size_t x, size_t y) {
+        const Color color = pixels[y * width + x];
+        const std::uint32_t R = color & 0xFF, G = (color >> 8) & 0xFF,
+                            B = (color >> 16) & 0xFF;
+        return (color >> 24) != 0 &&
+               0.2126 * R + 0.7152 * G + 0.0722 * B >= 128;
+    });
+}
+
+bool DomainMask::contains(Vector2 coord) const {
+    if (coord.x < 0 || coord.y < 0 || (size_t)coord.x >= width ||
+        (size_t)coord.y >= height)
+        return false;
+
+    // the last run starting at or before x.
+    const Run* run = std::upper_bound(
+        rowBegin(coord.y), rowEnd(coord.y), coord.x,
+        [](std::int32_t x, const Run& run) { return x < run.begin; });
+    return run != rowBegin(coord.y) && coord.x < (run - 1)->end;
+}
+
+Vector2 DomainMask::nearest(Vector2 coord) const {
+    if (contains(coord) || !area) return coord;
+
+    std::uint64_t best = UINT64_MAX;
+    Vector2 nearest = coord;
+    // rows farther away than the best distance so far cannot do better.
+    for (std::int64_t dy = 0; (std::uint64_t)(dy * dy) < best; ++dy) {
+        const std::int64_t rows[] = {coord.y - dy, coord.y + dy};
+        if (rows[0] < 0 && rows[1] >= (std::int64_t)height) break;
+
+        for (std::int64_t y : rows) {
+            if (y < 0 || y >= (std::int64_t)height) continue;
+            // only the runs on either side of x can be the nearest of the
+            // row, the left one first as a tie goes to it.
+            const Run* right = std::upper_bound(
+                rowBegin(y), rowEnd(y), coord.x,
+                [](std::int32_t x, const Run& run) { return x < run.begin; });
+            const Run* left = right == rowBegin(y) ? right : right - 1;
+            for (const Run* run = left; run != rowEnd(y) && run <= right;
+                 ++run) {
+                const std::int32_t x =
+                    std::clamp(coord.x, run->begin, run->end - 1);
+                const std::uint64_t distance =
+                    1ULL * (x - coord.x) * (x - coord.x) + dy * dy;
+                if (distance < best) {
+                    best = distance;
+                    nearest = Vector2(x, y);
+                }
+            }
+        }
+    }
+    return nearest;
+}
+
+Vector2 DomainMask::sample(Random& random) const {
+    const std::uint64_t index =
+        ((std::uint64_t)random.next() << 31 | (std::uint64_t)random.next()) %
+        area;
+    const size_t run =
+        std::upper_bound(offset.begin(), offset.end(), index) -
+        offset.begin() - 1;
+    const size_t y =
+        std::upper_bound(first.begin(), first.end(), run) - first.begin() - 1;
+    return Vector2(runs[run].begin + (index - offset[run]), y);
+}
+
+DomainMask DomainMask::resampled(size_t width, size_t height) const {
+    const double scaleX = (double)this->width / width,
+                 scaleY = (double)this->height / height;
+    return DomainMask(width, height, [&](size_t x, size_t y) {
+        return contains(Vector2((x + 0.5) * scaleX, (y + 0.5) * scaleY));
+    });
+}
@@ -0,0 +1,81 @@
+#ifndef STIPPLING_MASK_
+#define STIPPLING_MASK_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Vector2.hpp"
+#include "image.hpp"
+#include "random.hpp"
+
+// The pixels of the drawing region, stored as the runs of every row. Pixels
+// outside are never sampled, labelled or turned into spans.
+class DomainMask {
+   public:
+    struct Run {
+        std::int32_t begin, end;  // [begin, end) columns
+
+        bool operator==(const Run& other) const {
+            return begin == other.begin && end == other.end;
+        }
+    };
+
+   private:
+    size_t width, height, area = 0;
+    // the runs of row y are runs[first[y] .. first[y + 1]), and offset[i]
+    // the number of pixels inside before runs[i].
+    std::vector<size_t> first, offset;
+    std::vector<Run> runs;
+
+   public:
+    // `inside(x, y)` tells whether pixel (x, y) is in the region.
+    template <typename Inside>
+    DomainMask(size_t width, size_t height, Inside inside)
+        : width(width), height(height) {
+        first.push_back(0);
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width;) {
+                if (!inside(x, y)) {
+                    ++x;
+                    continue;
+                }
+                const size_t begin = x;
+                while (x < width && inside(x, y)) ++x;
+                runs.push_back({(std::int32_t)begin, (std::int32_t)x});
+                offset.push_back(area);
+                area += x - begin;
+            }
+            first.push_back(runs.size());
+        }
+    }
+
+    // Opaque pixels of `img`, i.e. with a non zero alpha.
+    static DomainMask fromAlpha(const Image& img);
+    // Opaque pixels of `img` that are lighter than mid gray.
+    static DomainMask fromImage(const Image& img);
+
+    size_t getWidth() const { return width; }
+    size_t getHeight() const { return height; }
+    size_t getArea() const { return area; }
+    bool isFull() const { return area == width * height; }
+
+    const Run* rowBegin(size_t y) const { return runs.data() + first[y]; }
+    const Run* rowEnd(size_t y) const { return runs.data() + first[y + 1]; }
+
+    bool operator==(const DomainMask& other) const {
+        return width == other.width && height == other.height &&
+               first == other.first && runs == other.runs;
+    }
+
+    bool contains(Vector2 coord) const;
+    // The inside pixel nearest to `coord`, `coord` itself when inside.
+    Vector2 nearest(Vector2 coord) const;
+    // A uniformly random inside pixel, the mask must not be empty.
+    Vector2 sample(Random& random) const;
+
+    // Nearest neighbour resampling to `width` x `height`.
+    DomainMask resampled(size_t width, size_t height) const;
+};
+
+#endif  // STIPPLING_MASK_
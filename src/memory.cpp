@@ -0,0 +1,120 @@
+#include "memory.hpp"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+
+namespace {
+
+const char* const SUBSYSTEM_NAMES[SUBSYSTEMS] = {
+    "pixels", "density", "prefix", "labels", "visited", "queue", "spans"};
+
+std::atomic<std::size_t> current[SUBSYSTEMS], peak[SUBSYSTEMS];
+
+struct Phase {
+    std::string name;
+    std::size_t peak[SUBSYSTEMS];
+    std::size_t total, rss, peakRss;
+};
+
+constexpr double MIB = 1 << 20;
+
+std::mutex phasesMutex;
+std::vector<Phase> phases;
+
+// `key:` line of /proc/self/status in bytes, 0 if there is none.
+std::size_t statusBytes(const char* key) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    const std::size_t length = std::char_traits<char>::length(key);
+    while (std::getline(status, line))
+        if (line.compare(0, length, key) == 0)
+            return std::stoull(line.substr(length)) * 1024;
+    return 0;
+}
+
+void writeRow(std::ostream& out, const Phase& phase) {
+    out << std::left << std::setw(12) << phase.name << std::right << std::fixed
+        << std::setprecision(2);
+    for (std::size_t s = 0; s < SUBSYSTEMS; ++s)
+        out << std::setw(10) << phase.peak[s] / MIB;
+    out << std::setw(10) << phase.total / MIB << std::setw(10)
+        << phase.rss / MIB << std::setw(10) << phase.peakRss / MIB << '\n';
+}
+
+}  // namespace
+
+void MemoryAccounting::enable() {
+    resetPeakRss();
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+void MemoryAccounting::charge(Subsystem subsystem, std::size_t bytes) {
+    const unsigned s = (unsigned)subsystem;
+    const std::size_t now = current[s].fetch_add(bytes) + bytes;
+    std::size_t high = peak[s].load();
+    while (now > high && !peak[s].compare_exchange_weak(high, now)) {
+    }
+}
+
+void MemoryAccounting::release(Subsystem subsystem, std::size_t bytes) {
+    current[(unsigned)subsystem].fetch_sub(bytes);
+}
+
+void MemoryAccounting::checkpoint(const std::string name) {
+    if (!isEnabled()) return;
+
+    Phase phase{name, {}, 0, rssBytes(), peakRssBytes()};
+    for (std::size_t s = 0; s < SUBSYSTEMS; ++s) {
+        phase.peak[s] = peak[s].exchange(current[s].load());
+        phase.total += phase.peak[s];
+    }
+    resetPeakRss();
+
+    std::lock_guard<std::mutex> lock(phasesMutex);
+    phases.push_back(phase);
+}
+
+void MemoryAccounting::report(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(phasesMutex);
+    const std::ios_base::fmtflags flags = out.flags();
+
+    out << "MEMORY (MiB, peak during each phase)\n" << std::left
+        << std::setw(12) << "phase" << std::right;
+    for (auto name : SUBSYSTEM_NAMES) out << std::setw(10) << name;
+    out << std::setw(10) << "total" << std::setw(10) << "rss"
+        << std::setw(10) << "peak rss" << '\n';
+
+    // the total is the sum of the peaks, an upper bound of the peak of the sum.
+    Phase overall{"peak", {}, 0, 0, 0};
+    for (auto& phase : phases) {
+        writeRow(out, phase);
+        for (std::size_t s = 0; s < SUBSYSTEMS; ++s)
+            overall.peak[s] = std::max(overall.peak[s], phase.peak[s]);
+        overall.total = std::max(overall.total, phase.total);
+        overall.rss = std::max(overall.rss, phase.rss);
+        overall.peakRss = std::max(overall.peakRss, phase.peakRss);
+    }
+    writeRow(out, overall);
+    out.flags(flags);
+}
+
+std::size_t rssBytes() { return statusBytes("VmRSS:"); }
+
+std::size_t peakRssBytes() {
+    if (const std::size_t bytes = statusBytes("VmHWM:")) return bytes;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (std::size_t)usage.ru_maxrss * 1024;
+}
+
+void resetPeakRss() {
+    // resets VmHWM to the current RSS, getrusage has no such thing.
+    std::ofstream clear("/proc/self/clear_refs");
+    if (clear) clear << "5";
+}
@@ -0,0 +1,98 @@
+#ifndef STIPPLING_MEMORY_
+#define STIPPLING_MEMORY_
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// The large buffers of the pipeline, by owner.
+enum class Subsystem : unsigned {
+    PixelMap,
+    Density,
+    PrefixTables,
+    LabelGrid,
+    VisitedGrid,
+    PriorityQueue,
+    Spans,
+};
+constexpr std::size_t SUBSYSTEMS = 7;
+
+// Bytes held by every subsystem, and their peaks between checkpoints. While
+// accounting is disabled, charges are not even computed.
+class MemoryAccounting {
+   private:
+    inline static std::atomic<bool> enabled{false};
+
+   public:
+    static bool isEnabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    static void enable();
+
+    static void charge(Subsystem subsystem, std::size_t bytes);
+    static void release(Subsystem subsystem, std::size_t bytes);
+
+    // Ends the phase `name` that started at the previous checkpoint: keeps
+    // the peak bytes of every subsystem and the peak RSS during it.
+    static void checkpoint(const std::string name);
+
+    // One row per phase, in MiB, and the peak of every column.
+    static void report(std::ostream& out);
+};
+
+// Charges `bytes` to `subsystem` for its lifetime, moves along with the
+// buffer it accounts for.
+class MemoryCharge {
+   private:
+    Subsystem subsystem;
+    std::size_t bytes = 0;
+
+   public:
+    MemoryCharge(Subsystem subsystem, std::size_t bytes = 0)
+        : subsystem(subsystem) {
+        resize(bytes);
+    }
+    MemoryCharge(const MemoryCharge& other) : MemoryCharge(other.subsystem) {
+        resize(other.bytes);
+    }
+    MemoryCharge(MemoryCharge&& other)
+        : subsystem(other.subsystem), bytes(other.bytes) {
+        other.bytes = 0;
+    }
+    MemoryCharge& operator=(MemoryCharge other) {
+        std::swap(subsystem, other.subsystem);
+        std::swap(bytes, other.bytes);
+        return *this;
+    }
+    ~MemoryCharge() { resize(0); }
+
+    void resize(std::size_t size) {
+        if (!MemoryAccounting::isEnabled()) size = 0;
+        if (size > bytes) MemoryAccounting::charge(subsystem, size - bytes);
+        if (size < bytes) MemoryAccounting::release(subsystem, bytes - size);
+        bytes = size;
+    }
+};
+
+// Heap bytes of a table of rows, such as a Grid or a PrefixFunction.
+template <typename T>
+std::size_t tableBytes(const std::vector<std::vector<T>>& table) {
+    std::size_t bytes = table.capacity() * sizeof(std::vector<T>);
+    for (auto& row : table)
+        bytes += std::is_same_v<T, bool> ? (row.capacity() + 7) / 8
+                                         : row.capacity() * sizeof(T);
+    return bytes;
+}
+
+// Resident set size of the process, and its peak since the last
+// resetPeakRss (or the start), from /proc/self/status or getrusage.
+std::size_t rssBytes();
+std::size_t peakRssBytes();
+// Resets the peak RSS of the process to the current RSS, where the kernel
+// allows it (Linux 4.0+).
+void resetPeakRss();
+
+#endif  // STIPPLING_MEMORY_
@@ -0,0 +1,40 @@
+#ifndef STIPPLING_PARALLEL_
+#define STIPPLING_PARALLEL_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Runs body(i, worker) for every i in [0, count) on up to `threads` threads
+// (the calling one included), handing out indices dynamically. `worker` is
+// the index, in [0, threads), of the thread running the call, e.g. to pick
+// per-thread state.
+template <typename Body>
+void parallelForWorker(std::size_t count, unsigned threads, Body body) {
+    threads = std::max(1u, std::min<unsigned>(threads, count));
+    if (threads == 1) {
+        for (std::size_t i = 0; i < count; ++i) body(i, 0u);
+        return;
+    }
+
+    std::atomic<std::size_t> next{0};
+    auto worker = [&](unsigned w) {
+        for (std::size_t i; (i = next.fetch_add(1)) < count;) body(i, w);
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : pool) thread.join();
+}
+
+// Runs body(i) for every i in [0, count), as parallelForWorker.
+template <typename Body>
+void parallelFor(std::size_t count, unsigned threads, Body body) {
+    parallelForWorker(count, threads,
+                      [&](std::size_t i, unsigned) { body(i); });
+}
+
+#endif  // STIPPLING_PARALLEL_
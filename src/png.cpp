@@ -0,0 +1,362 @@
+#include "png.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "parallel.hpp"
+#include "trace.hpp"
+#include "writer.hpp"
+
+namespace {
+
+typedef std::vector<std::uint8_t> Bytes;
+
+// rows per strip never go below this, tiny strips only cost compression.
+constexpr std::size_t MIN_STRIP_ROWS = 16;
+
+constexpr std::uint32_t ADLER_BASE = 65521;
+
+std::uint32_t adler32(const std::uint8_t* data, std::size_t size) {
+    std::uint32_t a = 1, b = 0;
+    while (size) {
+        // 5552 bytes is the most that can be summed before b overflows.
+        std::size_t n = std::min<std::size_t>(size, 5552);
+        size -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return b << 16 | a;
+}
+
+// adler32 of A + B, from adler32 of A and of B, and the length of B.
+std::uint32_t adler32Combine(std::uint32_t adlerA, std::uint32_t adlerB,
+                             std::size_t lengthB) {
+    const std::uint32_t rem = lengthB % ADLER_BASE;
+    std::uint32_t sum1 = adlerA & 0xFFFF;
+    std::uint32_t sum2 = (std::uint64_t)rem * sum1 % ADLER_BASE;
+    sum1 += (adlerB & 0xFFFF) + ADLER_BASE - 1;
+    sum2 += (adlerA >> 16) + (adlerB >> 16) + ADLER_BASE - rem;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum2 >= 2 * ADLER_BASE) sum2 -= 2 * ADLER_BASE;
+    if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+    return sum2 << 16 | sum1;
+}
+
+std::uint32_t crc32(std::uint32_t crc, const std::uint8_t* data,
+                    std::size_t size) {
+    static const struct Table {
+        std::uint32_t values[256];
+        Table() {
+            for (std::uint32_t n = 0; n < 256; ++n) {
+                std::uint32_t c = n;
+                for (int k = 0; k < 8; ++k)
+                    c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                values[n] = c;
+            }
+        }
+    } table;
+
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; ++i)
+        crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// LSB first bit stream, as deflate wants it.
+class BitWriter {
+   private:
+    Bytes& out;
+    std::uint64_t bits = 0;
+    int count = 0;
+
+   public:
+    BitWriter(Bytes& out) : out(out) {}
+
+    void put(std::uint32_t value, int length) {
+        bits |= (std::uint64_t)value << count;
+        count += length;
+        while (count >= 8) {
+            out.push_back(bits & 0xFF);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    // huffman codes are defined MSB first.
+    void putCode(std::uint32_t code, int length) {
+        std::uint32_t reversed = 0;
+        for (int i = 0; i < length; ++i)
+            reversed |= ((code >> i) & 1) << (length - 1 - i);
+        put(reversed, length);
+    }
+
+    void align() {
+        if (count) put(0, 8 - count);
+    }
+};
+
+// the fixed huffman code of literal/length symbol `symbol`.
+void putLiteral(BitWriter& bits, std::uint32_t symbol) {
+    if (symbol < 144)
+        bits.putCode(0x30 + symbol, 8);
+    else if (symbol < 256)
+        bits.putCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        bits.putCode(symbol - 256, 7);
+    else
+        bits.putCode(0xC0 + symbol - 280, 8);
+}
+
+const std::uint16_t LENGTH_BASE[] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                     11, 13, 15, 17,  19,  23,  27,  31,
+                                     35, 43, 51, 59,  67,  83,  99,  115,
+                                     131, 163, 195, 227, 258};
+const std::uint8_t LENGTH_EXTRA[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                     1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                     4, 4, 4, 4, 5, 5, 5, 5, 0};
+const std::uint16_t DISTANCE_BASE[] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const std::uint8_t DISTANCE_EXTRA[] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                       4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                       9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+void putMatch(BitWriter& bits, std::size_t length, std::size_t distance) {
+    int code = 28;
+    while (LENGTH_BASE[code] > length) --code;
+    putLiteral(bits, 257 + code);
+    bits.put(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+
+    code = 29;
+    while (DISTANCE_BASE[code] > distance) --code;
+    bits.putCode(code, 5);
+    bits.put(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+}
+
+// One non-final fixed huffman block of `data` (LZ77 with hash chains), then
+// an empty stored block, so that the output ends on a byte boundary and the
+// next strip can be appended as is.
+void deflateStrip(const Bytes& data, Bytes& out) {
+    constexpr std::size_t WINDOW = 32768, MAX_MATCH = 258, MIN_MATCH = 3;
+    constexpr std::size_t HASH_BITS = 15, MAX_CHAIN = 32;
+
+    BitWriter bits(out);
+    bits.put(0, 1);  // BFINAL
+    bits.put(1, 2);  // BTYPE: fixed huffman
+
+    // previous position with the same hash, for the last WINDOW positions.
+    std::vector<std::int64_t> head(1 << HASH_BITS, -1);
+    std::vector<std::int64_t> previous(WINDOW, -1);
+    auto hash = [&](std::size_t i) {
+        std::uint32_t h = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+        return (h * 2654435761u) >> (32 - HASH_BITS);
+    };
+    auto insert = [&](std::size_t i) {
+        if (i + MIN_MATCH > data.size()) return;
+        std::uint32_t h = hash(i);
+        previous[i % WINDOW] = head[h];
+        head[h] = i;
+    };
+
+    std::size_t i = 0;
+    while (i < data.size()) {
+        std::size_t bestLength = 0, bestDistance = 0;
+
+        if (i + MIN_MATCH <= data.size()) {
+            const std::size_t limit = std::min(MAX_MATCH, data.size() - i);
+            std::int64_t candidate = head[hash(i)];
+            for (std::size_t chain = 0; candidate >= 0 &&
+                                        i - candidate <= WINDOW &&
+                                        chain < MAX_CHAIN;
+                 ++chain, candidate = previous[candidate % WINDOW]) {
+                std::size_t length = 0;
+                while (length < limit &&
+                       data[candidate + length] == data[i + length])
+                    ++length;
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = i - candidate;
+                    if (length == limit) break;
+                }
+            }
+        }
+
+        if (bestLength >= MIN_MATCH) {
+            putMatch(bits, bestLength, bestDistance);
+            for (std::size_t k = 0; k < bestLength; ++k) insert(i + k);
+            i += bestLength;
+        } else {
+            putLiteral(bits, data[i]);
+            insert(i);
+            ++i;
+        }
+    }
+
+    putLiteral(bits, 256);  // end of block
+
+    // empty stored block: header, alignment, LEN = 0, NLEN = ~0.
+    bits.put(0, 3);
+    bits.align();
+    const std::uint8_t empty[] = {0x00, 0x00, 0xFF, 0xFF};
+    out.insert(out.end(), empty, empty + 4);
+}
+
+inline std::uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b),
+        pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// Filters `row` (with `above` the previous row, or NULL) into `out` (filter
+// type byte first), picking the filter with the least sum of absolute values.
+// `scratch` must hold `size` bytes.
+void filterRow(const std::uint8_t* row, const std::uint8_t* above,
+               std::size_t size, std::uint8_t* out, std::uint8_t* scratch) {
+    constexpr std::size_t BPP = sizeof(Color);
+    std::uint8_t* candidate = scratch;
+
+    std::uint64_t bestScore = UINT64_MAX;
+    std::uint8_t bestType = 0;
+
+    for (std::uint8_t type = 0; type < 5; ++type) {
+        std::uint64_t score = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            int a = i >= BPP ? row[i - BPP] : 0, b = above ? above[i] : 0,
+                c = (i >= BPP && above) ? above[i - BPP] : 0;
+            std::uint8_t predictor = 0;
+            switch (type) {
+                case 1: predictor = a; break;
+                case 2: predictor = b; break;
+                case 3: predictor = (a + b) >> 1; break;
+                case 4: predictor = paeth(a, b, c); break;
+            }
+            candidate[i] = row[i] - predictor;
+            score += std::abs((std::int8_t)candidate[i]);
+        }
+        if (score < bestScore) {
+            bestScore = score;
+            bestType = type;
+            std::memcpy(out + 1, candidate, size);
+        }
+    }
+
+    out[0] = bestType;
+}
+
+void putU32(Bytes& out, std::uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(value >> shift);
+}
+
+// length, type, data and crc of a chunk whose type and data are in `body`.
+void writeChunk(BufferedWriter& writer, const Bytes& body,
+                std::uint32_t crc) {
+    Bytes length;
+    putU32(length, body.size() - 4);
+    writer.write(length.data(), 4);
+    writer.write(body.data(), body.size());
+    Bytes trailer;
+    putU32(trailer, crc);
+    writer.write(trailer.data(), 4);
+}
+
+Bytes chunkBody(const char* type) { return Bytes(type, type + 4); }
+
+}  // namespace
+
+void writePNG(const std::string filename, const Color* pixels,
+              std::size_t width, std::size_t height, std::size_t stride,
+              unsigned threads) {
+    TRACE_SCOPE("encode");
+    const std::size_t rowSize = width * sizeof(Color);
+
+    std::size_t strips = threads > 1 ? 4 * threads : 1;
+    strips = std::max<std::size_t>(
+        1, std::min(strips, (height + MIN_STRIP_ROWS - 1) / MIN_STRIP_ROWS));
+    const std::size_t rowsPerStrip =
+        std::max<std::size_t>(1, (height + strips - 1) / strips);
+    strips = std::max<std::size_t>(1, (height + rowsPerStrip - 1) / rowsPerStrip);
+
+    // per strip: IDAT body (type + compressed data), its crc, the adler32 and
+    // the length of its uncompressed (filtered) bytes.
+    std::vector<Bytes> bodies(strips);
+    std::vector<std::uint32_t> crcs(strips), adlers(strips);
+    std::vector<std::size_t> lengths(strips);
+
+    parallelFor(strips, threads, [&](std::size_t s) {
+        TRACE_SCOPE("encode strip");
+        const std::size_t from = s * rowsPerStrip,
+                          to = std::min(height, from + rowsPerStrip);
+
+        Bytes filtered((to - from) * (rowSize + 1)), scratch(rowSize);
+        for (std::size_t y = from; y < to; ++y) {
+            const std::uint8_t* row =
+                (const std::uint8_t*)(pixels + y * stride);
+            const std::uint8_t* above =
+                y ? (const std::uint8_t*)(pixels + (y - 1) * stride) : NULL;
+            filterRow(row, above, rowSize,
+                      filtered.data() + (y - from) * (rowSize + 1),
+                      scratch.data());
+        }
+
+        adlers[s] = adler32(filtered.data(), filtered.size());
+        lengths[s] = filtered.size();
+
+        bodies[s] = chunkBody("IDAT");
+        if (s == 0) {
+            // zlib header: deflate, 32K window, no dictionary.
+            bodies[s].push_back(0x78);
+            bodies[s].push_back(0x01);
+        }
+        deflateStrip(filtered, bodies[s]);
+        crcs[s] = crc32(0, bodies[s].data(), bodies[s].size());
+    });
+
+    std::uint32_t adler = adlers[0];
+    for (std::size_t s = 1; s < strips; ++s)
+        adler = adler32Combine(adler, adlers[s], lengths[s]);
+
+    BufferedWriter writer(filename);
+
+    const std::uint8_t signature[] = {0x89, 'P',  'N',  'G',
+                                      '\r', '\n', 0x1A, '\n'};
+    writer.write(signature, sizeof(signature));
+
+    Bytes header = chunkBody("IHDR");
+    putU32(header, width);
+    putU32(header, height);
+    // 8 bit depth, RGBA, deflate, adaptive filtering, no interlace.
+    const std::uint8_t format[] = {8, 6, 0, 0, 0};
+    header.insert(header.end(), format, format + 5);
+    writeChunk(writer, header, crc32(0, header.data(), header.size()));
+
+    for (std::size_t s = 0; s < strips; ++s)
+        writeChunk(writer, bodies[s], crcs[s]);
+
+    // an empty final fixed huffman block, then the adler32 of everything.
+    Bytes last = chunkBody("IDAT");
+    {
+        BitWriter bits(last);
+        bits.put(1, 1);
+        bits.put(1, 2);
+        putLiteral(bits, 256);
+        bits.align();
+    }
+    putU32(last, adler);
+    writeChunk(writer, last, crc32(0, last.data(), last.size()));
+
+    Bytes end = chunkBody("IEND");
+    writeChunk(writer, end, crc32(0, end.data(), end.size()));
+
+    writer.close();
+}
@@ -0,0 +1,17 @@
+#ifndef STIPPLING_PNG_
+#define STIPPLING_PNG_
+
+#include <cstddef>
+#include <string>
+
+#include "image.hpp"
+
+// Writes an 8 bit RGBA png. The rows are cut into strips that are filtered and
+// deflated independently on up to `threads` threads; every strip ends on a
+// byte boundary (sync flush) and goes into its own IDAT chunk, and the adler32
+// of the strips are combined into the one of the whole zlib stream.
+void writePNG(const std::string filename, const Color* pixels,
+              std::size_t width, std::size_t height, std::size_t stride,
+              unsigned threads);
+
+#endif  // STIPPLING_PNG_
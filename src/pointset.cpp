@@ -0,0 +1,91 @@
+#include "pointset.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "writer.hpp"
+
+namespace {
+
+constexpr char MAGIC[4] = {'S', 'T', 'P', 'S'};
+
+std::size_t arrayCount(std::uint32_t flags) {
+    return 2 + !!(flags & POINTSET_RADIUS) + !!(flags & POINTSET_MASS);
+}
+
+void writeFloats(BufferedWriter& writer, const std::vector<float>& values) {
+    if (values.empty()) return;
+    writer.write(values.data(), values.size() * sizeof(float));
+}
+
+}  // namespace
+
+void savePointSet(const std::vector<Vector2>& generators,
+                  const StippleStyle& style, const std::string filename,
+                  const std::vector<float>& radii,
+                  const std::vector<float>& masses) {
+    if ((!radii.empty() && radii.size() != generators.size()) ||
+        (!masses.empty() && masses.size() != generators.size()))
+        throw "Point set attributes do not match the points.\n";
+
+    PointSetHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = POINTSET_VERSION;
+    header.width = style.width;
+    header.height = style.height;
+    header.count = generators.size();
+    header.coordinates = POINTSET_FLOAT32;
+    header.flags = (radii.empty() ? 0 : POINTSET_RADIUS) |
+                   (masses.empty() ? 0 : POINTSET_MASS);
+    header.radius = style.radius;
+
+    BufferedWriter writer(filename);
+    writer.write(&header, sizeof(header));
+
+    std::vector<float> coordinates(generators.size());
+    for (std::size_t i = 0; i < generators.size(); ++i)
+        coordinates[i] = style.centerX(generators[i]);
+    writeFloats(writer, coordinates);
+    for (std::size_t i = 0; i < generators.size(); ++i)
+        coordinates[i] = style.centerY(generators[i]);
+    writeFloats(writer, coordinates);
+
+    writeFloats(writer, radii);
+    writeFloats(writer, masses);
+    writer.close();
+}
+
+PointSet::PointSet(const std::string filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw "Could not open the point set file.\n";
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (std::size_t)st.st_size < sizeof(header)) {
+        close(fd);
+        throw "Not a point set file.\n";
+    }
+    size = st.st_size;
+
+    mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) throw "Could not map the point set file.\n";
+
+    std::memcpy(&header, mapped, sizeof(header));
+    const bool valid =
+        std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+        header.version == POINTSET_VERSION &&
+        header.coordinates == POINTSET_FLOAT32 &&
+        header.count <= size / sizeof(float) &&
+        size == sizeof(header) +
+                    arrayCount(header.flags) * header.count * sizeof(float);
+    if (!valid) {
+        munmap(mapped, size);
+        throw "Not a point set file, or an unsupported version.\n";
+    }
+}
+
+PointSet::~PointSet() { munmap(mapped, size); }
@@ -0,0 +1,79 @@
+#ifndef STIPPLING_POINTSET_
+#define STIPPLING_POINTSET_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Vector2.hpp"
+#include "vector_export.hpp"
+
+// Binary point set file, little endian: a PointSetHeader, then `count` x
+// coordinates and `count` y coordinates (struct of arrays), then `count`
+// radii and `count` masses if the flags say so. Coordinates are canvas
+// pixels, every array is 4 byte aligned so the file can be used mapped.
+constexpr std::uint32_t POINTSET_VERSION = 1;
+
+// coordinate types.
+constexpr std::uint32_t POINTSET_FLOAT32 = 1;
+
+// flags: per point radius (overriding the header one), per point mass.
+constexpr std::uint32_t POINTSET_RADIUS = 1;
+constexpr std::uint32_t POINTSET_MASS = 2;
+
+struct PointSetHeader {
+    char magic[4];  // "STPS"
+    std::uint32_t version;
+    std::uint32_t width, height;
+    std::uint64_t count;
+    std::uint32_t coordinates, flags;
+    float radius;
+    std::uint32_t reserved;
+};
+
+// Writes the generators as placed on the canvas of `style`; `radii` and
+// `masses` are either empty or have one entry per generator.
+void savePointSet(const std::vector<Vector2>& generators,
+                  const StippleStyle& style, const std::string filename,
+                  const std::vector<float>& radii = {},
+                  const std::vector<float>& masses = {});
+
+// Read-only view of a point set file through a memory mapping.
+class PointSet {
+   private:
+    void* mapped;
+    std::size_t size;
+    PointSetHeader header;
+
+    const float* array(std::size_t index) const {
+        return (const float*)((const char*)mapped + sizeof(PointSetHeader)) +
+               index * header.count;
+    }
+
+   public:
+    PointSet(const std::string filename);
+    ~PointSet();
+
+    PointSet(const PointSet&) = delete;
+    PointSet& operator=(const PointSet&) = delete;
+
+    std::size_t getWidth() const { return header.width; }
+    std::size_t getHeight() const { return header.height; }
+    std::size_t getCount() const { return header.count; }
+    // radius of the points when there are no per point radii.
+    float getRadius() const { return header.radius; }
+
+    const float* getX() const { return array(0); }
+    const float* getY() const { return array(1); }
+    // NULL when absent.
+    const float* getRadii() const {
+        return header.flags & POINTSET_RADIUS ? array(2) : NULL;
+    }
+    const float* getMasses() const {
+        if (!(header.flags & POINTSET_MASS)) return NULL;
+        return array(header.flags & POINTSET_RADIUS ? 3 : 2);
+    }
+};
+
+#endif  // STIPPLING_POINTSET_
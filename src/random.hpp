@@ -0,0 +1,61 @@
+#ifndef STIPPLING_RANDOM_
+#define STIPPLING_RANDOM_
+
+#include <cstdint>
+
+// The additive feedback generator behind glibc's rand(), with its state in
+// the object instead of the process: every StippleContext draws from its
+// own, and a seed still gives the stipple it gave with srand.
+class Random {
+   private:
+    static constexpr std::uint32_t DEGREE = 31, SEPARATION = 3;
+
+    std::uint32_t table[DEGREE];
+    std::uint32_t index = 0;
+
+   public:
+    // largest value of next(), as RAND_MAX.
+    static constexpr std::uint32_t MAX = 0x7FFFFFFF;
+
+    explicit Random(std::uint32_t seed = 1) { reseed(seed); }
+
+    // the whole state, to carry on the sequence from where it was saved.
+    struct State {
+        std::uint32_t table[DEGREE];
+        std::uint32_t index;
+    };
+
+    State getState() const {
+        State state;
+        for (std::uint32_t i = 0; i < DEGREE; ++i) state.table[i] = table[i];
+        state.index = index;
+        return state;
+    }
+
+    void setState(const State& state) {
+        for (std::uint32_t i = 0; i < DEGREE; ++i) table[i] = state.table[i];
+        index = state.index % DEGREE;
+    }
+
+    void reseed(std::uint32_t seed) {
+        std::int64_t word = (std::int32_t)(seed ? seed : 1);
+        table[0] = (std::uint32_t)word;
+        for (std::uint32_t i = 1; i < DEGREE; ++i) {
+            word = word * 16807 % 2147483647;
+            if (word < 0) word += 2147483647;
+            table[i] = (std::uint32_t)word;
+        }
+        // glibc drops the first 310 outputs.
+        index = 3;
+        for (int i = 0; i < 310; ++i) next();
+    }
+
+    std::uint32_t next() {
+        const std::uint32_t value =
+            table[index] += table[(index + DEGREE - SEPARATION) % DEGREE];
+        index = index + 1 == DEGREE ? 0 : index + 1;
+        return value >> 1;
+    }
+};
+
+#endif  // STIPPLING_RANDOM_
@@ -0,0 +1,127 @@
+#include "render.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "kernels.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+
+namespace {
+
+// sub-pixel phases of the dot center per axis.
+constexpr int PHASES = 4;
+// samples per pixel and axis when computing the coverage of a sprite.
+constexpr int SAMPLES = 8;
+// rows of the image blended by one task.
+constexpr std::size_t BAND_ROWS = 64;
+
+// Coverage (0 to 255) of a disc of some radius, one `size` x `size` sprite
+// per phase. The sprite of phase (px, py) is for a center at
+// (origin + px / PHASES, origin + py / PHASES) inside its top left pixel.
+class DotSprites {
+   private:
+    std::vector<std::uint8_t> coverage;
+
+   public:
+    std::int32_t size;
+
+    explicit DotSprites(double radius)
+        : size(2 * (std::int32_t)std::ceil(radius) + 2) {
+        coverage.resize((std::size_t)PHASES * PHASES * size * size);
+        const double origin = size / 2;
+        for (int py = 0; py < PHASES; ++py) {
+            for (int px = 0; px < PHASES; ++px) {
+                const double cx = origin + (double)px / PHASES,
+                             cy = origin + (double)py / PHASES;
+                std::uint8_t* sprite = get(px, py);
+                for (std::int32_t y = 0; y < size; ++y) {
+                    for (std::int32_t x = 0; x < size; ++x) {
+                        int inside = 0;
+                        for (int sy = 0; sy < SAMPLES; ++sy) {
+                            for (int sx = 0; sx < SAMPLES; ++sx) {
+                                double dx = x + (sx + 0.5) / SAMPLES - cx,
+                                       dy = y + (sy + 0.5) / SAMPLES - cy;
+                                inside += dx * dx + dy * dy <= radius * radius;
+                            }
+                        }
+                        sprite[y * size + x] =
+                            (inside * 255 + SAMPLES * SAMPLES / 2) /
+                            (SAMPLES * SAMPLES);
+                    }
+                }
+            }
+        }
+    }
+
+    const std::uint8_t* get(int px, int py) const {
+        return coverage.data() + (std::size_t)(py * PHASES + px) * size * size;
+    }
+    std::uint8_t* get(int px, int py) {
+        return coverage.data() + (std::size_t)(py * PHASES + px) * size * size;
+    }
+};
+
+// A dot as the sprite of phase (px, py) with its top left pixel at (x, y).
+struct Stamp {
+    std::int32_t x, y;
+    int px, py;
+};
+
+}  // namespace
+
+void renderStipples(const std::vector<Vector2>& generators,
+                    const StippleStyle& style, Image& image,
+                    unsigned threads) {
+    TRACE_SCOPE("render");
+    const DotSprites sprites(style.radius);
+    const std::int32_t width = image.getWidth(), height = image.getHeight();
+
+    std::vector<Stamp> stamps;
+    stamps.reserve(generators.size());
+    for (auto& generator : generators) {
+        const double x = style.centerX(generator) - sprites.size / 2,
+                     y = style.centerY(generator) - sprites.size / 2;
+        const double fx = std::floor(x * PHASES + 0.5) / PHASES,
+                     fy = std::floor(y * PHASES + 0.5) / PHASES;
+        Stamp stamp{(std::int32_t)std::floor(fx), (std::int32_t)std::floor(fy),
+                    0, 0};
+        stamp.px = (int)((fx - stamp.x) * PHASES);
+        stamp.py = (int)((fy - stamp.y) * PHASES);
+        if (stamp.x + sprites.size <= 0 || stamp.x >= width ||
+            stamp.y + sprites.size <= 0 || stamp.y >= height)
+            continue;
+        stamps.push_back(stamp);
+    }
+    std::sort(stamps.begin(), stamps.end(),
+              [](const Stamp& a, const Stamp& b) {
+                  return a.y != b.y ? a.y < b.y : a.x < b.x;
+              });
+
+    const std::size_t bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+    parallelFor(bands, threads, [&](std::size_t band) {
+        TRACE_SCOPE("render band");
+        const std::int32_t top = band * BAND_ROWS,
+                           bottom = std::min<std::int32_t>(
+                               height, top + BAND_ROWS);
+
+        // the stamps reaching into [top, bottom) start within this range.
+        auto first = std::lower_bound(
+            stamps.begin(), stamps.end(), top - sprites.size + 1,
+            [](const Stamp& s, std::int32_t y) { return s.y < y; });
+        for (auto it = first; it != stamps.end() && it->y < bottom; ++it) {
+            const std::uint8_t* sprite = sprites.get(it->px, it->py);
+            const std::int32_t y0 = std::max(top, it->y),
+                               y1 = std::min(bottom, it->y + sprites.size),
+                               x0 = std::max(0, it->x),
+                               x1 = std::min(width, it->x + sprites.size);
+            for (std::int32_t y = y0; y < y1; ++y) {
+                const std::uint8_t* coverage =
+                    sprite + (y - it->y) * sprites.size - it->x;
+                blendCoverage(image.row(y) + x0, coverage + x0, x1 - x0,
+                              style.color);
+            }
+        }
+    });
+}
@@ -0,0 +1,18 @@
+#ifndef STIPPLING_RENDER_
+#define STIPPLING_RENDER_
+
+#include <vector>
+
+#include "Vector2.hpp"
+#include "image.hpp"
+#include "vector_export.hpp"
+
+// Draws the generator points into `image` (of the size of the style) as
+// anti-aliased dots blended over what is already there. The dots come from
+// sprites precomputed per sub-pixel phase of the center, and are stamped in
+// row order, band by band on up to `threads` threads.
+void renderStipples(const std::vector<Vector2>& generators,
+                    const StippleStyle& style, Image& image,
+                    unsigned threads);
+
+#endif  // STIPPLING_RENDER_
@@ -0,0 +1,522 @@
+#include "server.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "stipple.hpp"
+
+namespace {
+
+constexpr std::size_t CHUNK_BYTES = 1 << 20;
+
+// false on end of file or error.
+bool readFully(int fd, void* data, std::size_t size) {
+    char* out = (char*)data;
+    while (size) {
+        const ssize_t got = read(fd, out, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        out += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool writeFully(int fd, const void* data, std::size_t size) {
+    const char* in = (const char*)data;
+    while (size) {
+        const ssize_t put = write(fd, in, size);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return false;
+        in += put;
+        size -= put;
+    }
+    return true;
+}
+
+// Copies `size` bytes from `from` to `to`, false if either side fails.
+bool copyBytes(int from, int to, std::uint64_t size) {
+    std::vector<char> chunk(std::min<std::uint64_t>(size, CHUNK_BYTES));
+    while (size) {
+        const std::size_t bytes = std::min<std::uint64_t>(size, chunk.size());
+        if (!readFully(from, chunk.data(), bytes) ||
+            !writeFully(to, chunk.data(), bytes))
+            return false;
+        size -= bytes;
+    }
+    return true;
+}
+
+// True once the peer of socket `fd` has closed it. A client that only shut
+// down its writing side still waits for its responses.
+bool hungUp(int fd) {
+    pollfd poll{fd, 0, 0};
+    return ::poll(&poll, 1, 0) == 1 && (poll.revents & (POLLHUP | POLLERR));
+}
+
+struct Job;
+
+// One client. Its requests are read by a thread of its own, and handed to
+// the queue by another one, so that the reader never waits on the queue and
+// always sees cancellations. The responses are written by the workers as
+// the jobs finish.
+struct Connection {
+    int in, out;
+    bool owned;
+
+    std::mutex writeMutex;
+    // a response could not be written, the client is gone.
+    bool broken = false;
+
+    // jobs read but not queued yet, at most the queue depth of them.
+    std::mutex backlogMutex;
+    std::condition_variable backlogChanged;
+    std::deque<std::shared_ptr<Job>> backlog;
+    bool reading = true;
+
+    Connection(int in, int out, bool owned) : in(in), out(out), owned(owned) {}
+    ~Connection() {
+        if (owned) close(in);
+    }
+};
+
+struct Job {
+    std::shared_ptr<Connection> connection;
+    std::uint64_t id;
+    std::uint32_t format;
+    Config config;
+    // temporary files, removed with the job.
+    std::string input, output;
+    std::atomic<bool> cancelled{false};
+
+    ~Job() {
+        if (!input.empty()) unlink(input.c_str());
+        if (!output.empty()) unlink(output.c_str());
+    }
+};
+
+// The jobs waiting for a worker, at most `depth` of them.
+class JobQueue {
+   private:
+    std::mutex mutex;
+    std::condition_variable notFull, notEmpty;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::size_t depth;
+    bool closed = false;
+
+   public:
+    JobQueue(std::size_t depth) : depth(std::max<std::size_t>(1, depth)) {}
+
+    // Blocks while the queue is full. Returns false, without queueing it,
+    // when `job` is cancelled first.
+    bool push(const std::shared_ptr<Job>& job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock,
+                     [&]() { return jobs.size() < depth || job->cancelled; });
+        if (job->cancelled) return false;
+        jobs.push_back(job);
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Takes `job` out of the queue, if it is there. Also wakes the pushes
+    // that wait, so that a cancelled job is not queued anymore.
+    bool remove(const Job* job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        notFull.notify_all();
+        for (auto it = jobs.begin(); it != jobs.end(); ++it)
+            if (it->get() == job) {
+                jobs.erase(it);
+                return true;
+            }
+        return false;
+    }
+
+    // Blocks while the queue is empty, returns null once it is closed too.
+    std::shared_ptr<Job> pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]() { return !jobs.empty() || closed; });
+        if (jobs.empty()) return nullptr;
+        std::shared_ptr<Job> job = std::move(jobs.front());
+        jobs.pop_front();
+        notFull.notify_one();
+        return job;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+class Server {
+   private:
+    const Config& base;
+    JobQueue queue;
+    // of every connection, see Connection.
+    std::size_t backlogDepth;
+
+    // every job not answered yet, by connection and id, for cancellation.
+    std::mutex jobsMutex;
+    std::map<std::pair<const Connection*, std::uint64_t>, std::shared_ptr<Job>>
+        jobs;
+
+    std::mutex logMutex;
+
+    std::string temporaryFile(const char* suffix);
+    std::shared_ptr<Job> submit(const std::shared_ptr<Connection>& connection,
+                                const JobRequest& request);
+    void readRequests(const std::shared_ptr<Connection>& connection);
+    // Moves the backlog of `connection` to the queue until it stops reading.
+    void push(Connection& connection);
+    // A job that is not running yet is answered right away, a running one
+    // stops at its next iteration.
+    void cancel(const std::shared_ptr<Job>& job);
+    void cancel(const Connection& connection);
+    void respond(Job& job, std::uint32_t status, const std::string message);
+    void finish(Job& job, std::uint32_t status, const std::string message,
+                const JobResult& result,
+                std::chrono::steady_clock::time_point start);
+    void run(Job& job, StippleContext& context);
+
+   public:
+    Server(const Config& base, std::size_t queueDepth)
+        : base(base),
+          queue(queueDepth),
+          backlogDepth(std::max<std::size_t>(1, queueDepth)) {}
+
+    // Reads the requests of `connection` until it ends or breaks the
+    // protocol, and returns once all its jobs are queued. The jobs of a
+    // client that hung up are cancelled.
+    void read(std::shared_ptr<Connection> connection);
+    void work();
+    void close() { queue.close(); }
+};
+
+std::string Server::temporaryFile(const char* suffix) {
+    std::string path =
+        base.getTileDirectory() + "/stipple-job-XXXXXX" + suffix;
+    const int fd = mkstemps(path.data(), std::strlen(suffix));
+    if (fd < 0) throw "Could not create a temporary job file.\n";
+    ::close(fd);
+    return path;
+}
+
+std::shared_ptr<Job> Server::submit(
+    const std::shared_ptr<Connection>& connection, const JobRequest& request) {
+    auto job = std::make_shared<Job>();
+    job->connection = connection;
+    job->id = request.id;
+    job->format = request.format;
+
+    Config& config = job->config;
+    config = base;
+    config.setVerbose(false);
+    config.setThreads(1);
+    if (request.points) config.setGeneratorPoints(request.points);
+    if (request.iterations) config.setIterations(request.iterations);
+    if (request.seed) config.setSeed(request.seed);
+    if (request.radius) config.setGeneratorRadius(request.radius);
+    if (request.initMode &&
+        request.initMode <= (std::uint32_t)InitMode::Streaming + 1)
+        config.setInitMode((InitMode)(request.initMode - 1));
+    if (request.outputWidth) {
+        config.setOutputWidth(request.outputWidth);
+        config.setOutputHeight(request.outputHeight);
+    }
+    if (request.computeScale > 0) config.setComputeScale(request.computeScale);
+
+    job->input = temporaryFile("");
+    config.setInFilename(job->input);
+    config.clearOutputs();
+    if (request.format == OUTPUT_POINTS) {
+        job->output = temporaryFile(".stps");
+        config.setPointsFilename(job->output);
+    } else {
+        job->output =
+            temporaryFile(request.format == OUTPUT_SVG ? ".svg" : ".png");
+        config.setOutFilename(job->output);
+    }
+    return job;
+}
+
+void Server::read(std::shared_ptr<Connection> connection) {
+    std::thread pusher([this, connection]() { push(*connection); });
+    readRequests(connection);
+    {
+        std::lock_guard<std::mutex> lock(connection->backlogMutex);
+        connection->reading = false;
+        connection->backlogChanged.notify_all();
+    }
+    if (connection->owned && hungUp(connection->in)) cancel(*connection);
+    pusher.join();
+}
+
+void Server::readRequests(const std::shared_ptr<Connection>& connection) {
+    JobRequest request;
+    while (readFully(connection->in, &request, sizeof(request))) {
+        if (std::memcmp(request.magic, "STJQ", 4) != 0 ||
+            request.version != SERVER_VERSION)
+            break;
+
+        if (request.type == REQUEST_CANCEL) {
+            std::shared_ptr<Job> job;
+            {
+                std::lock_guard<std::mutex> lock(jobsMutex);
+                auto it = jobs.find({connection.get(), request.id});
+                if (it != jobs.end()) job = it->second;
+            }
+            if (job) cancel(job);
+            continue;
+        }
+
+        std::shared_ptr<Job> job;
+        try {
+            if (request.type != REQUEST_SUBMIT) throw "Unknown request.\n";
+            if (request.size > MAX_REQUEST_BYTES) throw "Image too large.\n";
+            job = submit(connection, request);
+        } catch (const char* error) {
+            Job refused;
+            refused.connection = connection;
+            refused.id = request.id;
+            refused.format = request.format;
+            respond(refused, RESPONSE_FAILED, error);
+            // the image bytes, if any, are not read.
+            break;
+        }
+
+        {
+            const int fd = open(job->input.c_str(), O_WRONLY | O_TRUNC);
+            const bool copied =
+                fd >= 0 && copyBytes(connection->in, fd, request.size);
+            if (fd >= 0) ::close(fd);
+            if (!copied) break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs[{connection.get(), job->id}] = job;
+        }
+        // blocks once the backlog is full too, and with it this client.
+        std::unique_lock<std::mutex> lock(connection->backlogMutex);
+        connection->backlogChanged.wait(lock, [&]() {
+            return connection->backlog.size() < backlogDepth;
+        });
+        connection->backlog.push_back(std::move(job));
+        connection->backlogChanged.notify_all();
+    }
+}
+
+void Server::push(Connection& connection) {
+    for (;;) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(connection.backlogMutex);
+            connection.backlogChanged.wait(lock, [&]() {
+                return !connection.backlog.empty() || !connection.reading;
+            });
+            if (connection.backlog.empty()) return;
+            job = std::move(connection.backlog.front());
+            connection.backlog.pop_front();
+            connection.backlogChanged.notify_all();
+        }
+        // a job cancelled before it was queued is answered right away.
+        if (!queue.push(job))
+            finish(*job, RESPONSE_CANCELLED, "", JobResult{Vector2(0, 0), 0},
+                   std::chrono::steady_clock::now());
+    }
+}
+
+void Server::cancel(const std::shared_ptr<Job>& job) {
+    job->cancelled = true;
+    bool waiting = queue.remove(job.get());
+    {
+        Connection& connection = *job->connection;
+        std::lock_guard<std::mutex> lock(connection.backlogMutex);
+        auto& backlog = connection.backlog;
+        auto it = std::find(backlog.begin(), backlog.end(), job);
+        if (it != backlog.end()) {
+            backlog.erase(it);
+            connection.backlogChanged.notify_all();
+            waiting = true;
+        }
+    }
+    // otherwise a worker or the pusher holds it, and answers it.
+    if (waiting)
+        finish(*job, RESPONSE_CANCELLED, "", JobResult{Vector2(0, 0), 0},
+               std::chrono::steady_clock::now());
+}
+
+void Server::cancel(const Connection& connection) {
+    std::vector<std::shared_ptr<Job>> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        for (auto& [key, job] : jobs)
+            if (key.first == &connection) cancelled.push_back(job);
+    }
+    for (auto& job : cancelled) cancel(job);
+}
+
+void Server::respond(Job& job, std::uint32_t status,
+                     const std::string message) {
+    JobResponse response{{'S', 'T', 'J', 'R'}, SERVER_VERSION, job.id, status,
+                         job.format, message.size()};
+
+    int fd = -1;
+    if (status == RESPONSE_DONE) {
+        fd = open(job.output.c_str(), O_RDONLY);
+        const off_t size = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+        if (size < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+            if (fd >= 0) ::close(fd);
+            respond(job, RESPONSE_FAILED, "Could not read the output.\n");
+            return;
+        }
+        response.size = size;
+    }
+
+    Connection& connection = *job.connection;
+    bool broke = false;
+    {
+        std::lock_guard<std::mutex> lock(connection.writeMutex);
+        if (!connection.broken)
+            broke = connection.broken =
+                !writeFully(connection.out, &response, sizeof(response)) ||
+                !(fd >= 0 ? copyBytes(fd, connection.out, response.size)
+                          : writeFully(connection.out, message.data(),
+                                       message.size()));
+    }
+    if (fd >= 0) ::close(fd);
+    // nobody is left to read the other results.
+    if (broke) cancel(connection);
+}
+
+void Server::run(Job& job, StippleContext& context) {
+    const auto start = std::chrono::steady_clock::now();
+    std::uint32_t status = RESPONSE_DONE;
+    std::string message;
+    JobResult result{Vector2(0, 0), 0};
+    try {
+        if (job.cancelled) throw JobCancelled();
+        result = runJob(job.config, &context, &job.cancelled);
+    } catch (const JobCancelled&) {
+        status = RESPONSE_CANCELLED;
+    } catch (const char* error) {
+        status = RESPONSE_FAILED;
+        message = error;
+    } catch (const std::exception& error) {
+        status = RESPONSE_FAILED;
+        message = std::string(error.what()) + '\n';
+    }
+    finish(job, status, message, result, start);
+}
+
+void Server::finish(Job& job, std::uint32_t status, const std::string message,
+                    const JobResult& result,
+                    std::chrono::steady_clock::time_point start) {
+    respond(job, status, message);
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        jobs.erase({job.connection.get(), job.id});
+    }
+
+    std::lock_guard<std::mutex> lock(logMutex);
+    std::cerr << "JOB " << job.id << ": ";
+    if (status == RESPONSE_DONE)
+        std::cerr << result.native.x << 'x' << result.native.y << ", "
+                  << result.generators << " points, ";
+    else
+        std::cerr << (status == RESPONSE_CANCELLED ? "cancelled, "
+                                                   : "failed, ");
+    std::cerr << std::fixed << std::setprecision(3)
+              << std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count()
+              << " s\n";
+}
+
+void Server::work() {
+    // kept from one job to the next, its buffers stay warm.
+    StippleContext context;
+    while (std::shared_ptr<Job> job = queue.pop()) run(*job, context);
+}
+
+}  // namespace
+
+void serve(const Config& config, const std::string socketPath,
+           std::size_t queueDepth) {
+    // a client that is gone must not take the server with it.
+    signal(SIGPIPE, SIG_IGN);
+#ifdef __GLIBC__
+    // freed buffers stay in the heap for the next job, instead of going back
+    // to the kernel and faulting in again.
+    mallopt(M_MMAP_THRESHOLD, 32 << 20);
+    mallopt(M_TRIM_THRESHOLD, 256 << 20);
+#endif
+
+    Server server(config, queueDepth);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::max(1u, config.getThreads()); ++t)
+        workers.emplace_back([&]() { server.work(); });
+
+    if (socketPath == "-") {
+        server.read(std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO,
+                                                 false));
+        server.close();
+        for (auto& worker : workers) worker.join();
+        return;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        throw "Socket path too long.\n";
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) throw "Could not create the socket.\n";
+    unlink(socketPath.c_str());
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0)
+        throw "Could not listen on the socket.\n";
+
+    std::cerr << "LISTENING: " << socketPath << '\n';
+    for (;;) {
+        const int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            // out of descriptors or buffers: give the jobs time to close
+            // some, rather than spinning on the same error.
+            if (errno != EINTR && errno != ECONNABORTED)
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        std::thread([&server, fd]() {
+            server.read(std::make_shared<Connection>(fd, fd, true));
+        }).detach();
+    }
+}
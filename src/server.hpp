@@ -0,0 +1,73 @@
+#ifndef STIPPLING_SERVER_
+#define STIPPLING_SERVER_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "job.hpp"
+
+// Framed job protocol of the stipple server, little endian. A client sends
+// JobRequest frames, a submit one followed by `size` bytes of an image in
+// any format the command line tool reads. The server answers every submitted
+// job with one JobResponse frame, followed by `size` bytes of output (or of
+// an error message, when the job failed), in the order the jobs finish.
+// Several jobs may be in flight on one connection; ids are the client's.
+constexpr std::uint32_t SERVER_VERSION = 1;
+
+// request types.
+constexpr std::uint32_t REQUEST_SUBMIT = 0;
+// cancels the job `id` of the same connection, whether queued or running;
+// a queued one is answered right away.
+constexpr std::uint32_t REQUEST_CANCEL = 1;
+
+// output formats.
+constexpr std::uint32_t OUTPUT_PNG = 0;
+constexpr std::uint32_t OUTPUT_POINTS = 1;  // see pointset.hpp
+constexpr std::uint32_t OUTPUT_SVG = 2;
+
+// response statuses.
+constexpr std::uint32_t RESPONSE_DONE = 0;
+constexpr std::uint32_t RESPONSE_FAILED = 1;
+constexpr std::uint32_t RESPONSE_CANCELLED = 2;
+
+// Larger images are refused before their bytes are read, and the connection
+// closed.
+constexpr std::uint64_t MAX_REQUEST_BYTES = 256 << 20;
+
+// Every parameter left at 0 takes the value the server was started with.
+struct JobRequest {
+    char magic[4];  // "STJQ"
+    std::uint32_t version;
+    std::uint64_t id;
+    std::uint32_t type, format;
+    std::uint32_t points, iterations, seed, radius;
+    // InitMode + 1.
+    std::uint32_t initMode;
+    std::uint32_t outputWidth, outputHeight;
+    float computeScale;
+    std::uint64_t size;
+};
+
+struct JobResponse {
+    char magic[4];  // "STJR"
+    std::uint32_t version;
+    std::uint64_t id;
+    std::uint32_t status, format;
+    std::uint64_t size;
+};
+
+static_assert(sizeof(JobRequest) == 64, "JobRequest must not be padded");
+static_assert(sizeof(JobResponse) == 32, "JobResponse must not be padded");
+
+// Serves jobs on the unix domain socket `socketPath` until killed, or on
+// stdin/stdout when it is "-" until stdin ends. Jobs run on `-t` workers
+// that keep their buffers warm between jobs, on top of the options of
+// `config`. At most `queueDepth` jobs wait for a worker; beyond that every
+// connection holds up to `queueDepth` of its jobs back, and is only read
+// any further (so its client blocks) once they fit. The jobs of a client
+// that hangs up are cancelled.
+void serve(const Config& config, const std::string socketPath,
+           std::size_t queueDepth);
+
+#endif  // STIPPLING_SERVER_
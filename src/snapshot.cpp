@@ -0,0 +1,43 @@
+#include "snapshot.hpp"
+
+#include <utility>
+
+SnapshotWriter::SnapshotWriter(Save save)
+    : save(save), thread([this]() { run(); }) {}
+
+SnapshotWriter::~SnapshotWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void SnapshotWriter::submit(std::uint32_t iteration,
+                            const std::vector<Vector2>& generators,
+                            const Random::State& random) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.iteration = iteration;
+        // reuses the capacity of the buffer saved the time before.
+        pending.generators.assign(generators.begin(), generators.end());
+        pending.random = random;
+        hasPending = true;
+    }
+    wake.notify_one();
+}
+
+void SnapshotWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [&]() { return hasPending || stopping; });
+        if (!hasPending) return;
+        std::swap(pending, saving);
+        hasPending = false;
+
+        lock.unlock();
+        save(saving);
+        lock.lock();
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef STIPPLING_SNAPSHOT_
+#define STIPPLING_SNAPSHOT_
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Vector2.hpp"
+#include "random.hpp"
+#include "stipple.hpp"
+
+// Saves snapshots of a relaxation on a thread of its own, so that the
+// relaxation never waits for them to be written. The buffers are double:
+// submit fills one while the other is saved, and a snapshot that is not
+// being saved yet is replaced by the next one.
+class SnapshotWriter {
+   public:
+    typedef std::function<void(const StippleState&)> Save;
+
+   private:
+    Save save;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    StippleState pending, saving;
+    bool hasPending = false, stopping = false;
+    std::thread thread;
+
+    void run();
+
+   public:
+    SnapshotWriter(Save save);
+    // Saves the last submitted snapshot, if not already done.
+    ~SnapshotWriter();
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    // Copies the state after `iteration` steps and returns.
+    void submit(std::uint32_t iteration, const std::vector<Vector2>& generators,
+                const Random::State& random = {});
+};
+
+#endif  // STIPPLING_SNAPSHOT_
@@ -0,0 +1,106 @@
+#include "stipple.hpp"
+
+#include "cache.hpp"
+#include "trace.hpp"
+
+std::vector<Vector2> StippleContext::initialGenerators(
+    const DensityMap& density, const DomainMask* domain,
+    const StippleParameters& parameters) {
+    TRACE_SCOPE("sampling");
+    const std::size_t N = parameters.points;
+
+    switch (parameters.initMode) {
+        case InitMode::Uniform:
+            if (domain) return randomizeGenerators(N, *domain, random);
+            return randomizeGenerators(
+                N, Vector2(density.getWidth(), density.getHeight()), random);
+        case InitMode::LowDiscrepancy:
+            return lowDiscrepancySampling(N, prefixFunctions.first);
+        case InitMode::ErrorDiffusion:
+            return errorDiffusionSampling(N, density, random, domain);
+        case InitMode::Streaming: {
+            // the relaxation needs the whole density and its prefix tables
+            // anyway, so in memory this only gives the same sampling as the
+            // out-of-core path, not its memory bound.
+            DensityMapBandReader reader(density);
+            return streamingSampling(N, reader, parameters.bandRows, random);
+        }
+        case InitMode::Rejection:
+        default:
+            return rejectionSampling(N, density, random, domain);
+    }
+}
+
+std::vector<Vector2> StippleContext::cachedInitialGenerators(
+    const DensityMap& density, const DomainMask* domain,
+    const StippleParameters& parameters) {
+    if (parameters.cacheDirectory.empty())
+        return initialGenerators(density, domain, parameters);
+
+    const GeneratorCache cache(parameters.cacheDirectory);
+    const CacheKey key{
+        GeneratorCache::hash(density), parameters.points, parameters.seed,
+        (std::uint32_t)parameters.initMode,
+        parameters.initMode == InitMode::Streaming ? parameters.bandRows : 0};
+
+    std::vector<Vector2> generators;
+    if (cache.load(key, generators)) return generators;
+
+    generators = initialGenerators(density, domain, parameters);
+    cache.store(key, generators);
+    return generators;
+}
+
+std::vector<Vector2> StippleContext::stipple(
+    const DensityMap& density, const DomainMask* domain,
+    const StippleParameters& parameters, const IterationCallback& onIteration,
+    const StippleState* resume) {
+    random.reseed(parameters.seed);
+
+    density.computePrefixFunctions(prefixFunctions);
+    prefixCharge.resize(tableBytes(prefixFunctions.first) +
+                        tableBytes(prefixFunctions.second));
+    MemoryAccounting::checkpoint("prefix");
+
+    std::vector<Vector2> generators;
+    if (resume) {
+        generators = resume->generators;
+        random.setState(resume->random);
+    } else {
+        generators = cachedInitialGenerators(density, domain, parameters);
+        MemoryAccounting::checkpoint("sampling");
+    }
+
+    const Vector2 dimensions(density.getWidth(), density.getHeight());
+    for (std::size_t i = resume ? resume->iteration : 0;
+         i < parameters.iterations; ++i) {
+        TRACE_SCOPE("iteration");
+        const unsigned threads = parameters.stepThreads
+                                     ? parameters.stepThreads()
+                                     : parameters.threads;
+        generators = relax(dimensions, generators, domain,
+                           parameters.labelling, threads);
+        snapToDomain(generators, domain);
+        MemoryAccounting::checkpoint("iteration " + std::to_string(i + 1));
+        if (onIteration) onIteration(i + 1, generators);
+    }
+
+    return generators;
+}
+
+std::vector<Vector2> StippleContext::relax(Vector2 dimensions,
+                                           std::vector<Vector2>& generators,
+                                           const DomainMask* domain,
+                                           Labelling labelling,
+                                           unsigned threads) {
+    if (labelling == Labelling::Nearest)
+        getNearestBoundaries(dimensions, generators, scratch, domain, threads);
+    else
+        getVoronoiBoundaries(dimensions, generators, scratch, nullptr, domain);
+    return computeVoronoiCenters(scratch.boundaries, prefixFunctions, threads);
+}
+
+void snapToDomain(std::vector<Vector2>& generators, const DomainMask* domain) {
+    if (!domain) return;
+    for (auto& generator : generators) generator = domain->nearest(generator);
+}
@@ -0,0 +1,115 @@
+#ifndef STIPPLING_STIPPLE_
+#define STIPPLING_STIPPLE_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Vector2.hpp"
+#include "density.hpp"
+#include "image.hpp"
+#include "mask.hpp"
+#include "memory.hpp"
+#include "random.hpp"
+#include "voronoi.hpp"
+
+enum class InitMode {
+    Uniform,
+    Rejection,
+    LowDiscrepancy,
+    ErrorDiffusion,
+    Streaming
+};
+
+// How the pixels are split into the cells of the generators: by a flood fill
+// from the generators, in the order of their distance (single threaded, and
+// a cell never crosses a gap of the domain), or each pixel by its nearest
+// generator (on any number of threads, as out-of-core).
+enum class Labelling { Flood, Nearest };
+
+constexpr std::uint32_t DEFAULT_GENERATOR_POINTS = 10000;
+constexpr std::uint32_t DEFAULT_ITERATIONS = 10;
+constexpr std::uint32_t DEFAULT_SEED = 420;
+constexpr std::uint32_t DEFAULT_BAND_ROWS = 256;
+
+// Everything a stipple depends on, besides its density.
+struct StippleParameters {
+    std::uint32_t points = DEFAULT_GENERATOR_POINTS;
+    std::uint32_t iterations = DEFAULT_ITERATIONS;
+    std::uint32_t seed = DEFAULT_SEED;
+    InitMode initMode = InitMode::Rejection;
+    // rows per band of the streaming initialisation.
+    std::uint32_t bandRows = DEFAULT_BAND_ROWS;
+    // caches the initial generators in this directory, unless empty.
+    std::string cacheDirectory;
+    Labelling labelling = Labelling::Flood;
+    // threads of the nearest labelling and of the centroids of a step; when
+    // set, `stepThreads` is asked before every step instead. Neither changes
+    // the stipple.
+    unsigned threads = 1;
+    std::function<unsigned()> stepThreads;
+};
+
+// Where a relaxation is: the generators after `iteration` steps, and the
+// random state they left behind.
+struct StippleState {
+    std::uint32_t iteration = 0;
+    std::vector<Vector2> generators;
+    Random::State random{};
+};
+
+// Called after every relaxation step, with its number (from 1) and the
+// generators it moved.
+typedef std::function<void(std::size_t, const std::vector<Vector2>&)>
+    IterationCallback;
+
+// Owns the random state and the scratch buffers (prefix tables, labels,
+// spans, flood-fill queue) of stippling, which are kept from one iteration
+// and one image to the next. Nothing is shared between contexts, so that
+// every thread can stipple with its own.
+class StippleContext {
+   private:
+    Random random;
+    std::pair<PrefixFunction, PrefixFunction> prefixFunctions;
+    MemoryCharge prefixCharge{Subsystem::PrefixTables};
+    VoronoiScratch scratch;
+
+    std::vector<Vector2> initialGenerators(const DensityMap& density,
+                                           const DomainMask* domain,
+                                           const StippleParameters& parameters);
+    std::vector<Vector2> cachedInitialGenerators(
+        const DensityMap& density, const DomainMask* domain,
+        const StippleParameters& parameters);
+
+   public:
+    StippleContext() = default;
+
+    StippleContext(const StippleContext&) = delete;
+    StippleContext& operator=(const StippleContext&) = delete;
+
+    // The generators of the stipple of `density`, on its grid. `density` is
+    // already cleared outside of `domain`, when there is one. From `resume`,
+    // the initialisation and the steps it already took are skipped.
+    std::vector<Vector2> stipple(const DensityMap& density,
+                                 const DomainMask* domain,
+                                 const StippleParameters& parameters,
+                                 const IterationCallback& onIteration = {},
+                                 const StippleState* resume = nullptr);
+
+    Random::State getRandomState() const { return random.getState(); }
+
+    // One step of Lloyd's relaxation: the centroids of the cells of
+    // `generators`, with the prefix functions of the last stippled density.
+    std::vector<Vector2> relax(Vector2 dimensions,
+                               std::vector<Vector2>& generators,
+                               const DomainMask* domain,
+                               Labelling labelling = Labelling::Flood,
+                               unsigned threads = 1);
+};
+
+// Centroids of cells that are not convex may fall outside of the domain.
+void snapToDomain(std::vector<Vector2>& generators, const DomainMask* domain);
+
+#endif  // STIPPLING_STIPPLE_
@@ -0,0 +1,85 @@
+#include "synthetic.hpp"
+
+#include <algorithm>
+
+namespace {
+
+constexpr SyntheticPattern PATTERNS[] = {
+    SyntheticPattern::Circles, SyntheticPattern::Gradient,
+    SyntheticPattern::Checkerboard, SyntheticPattern::Noise};
+
+inline Color gray(std::uint32_t level) {
+    return 0xFF000000 | level << 16 | level << 8 | level;
+}
+
+}  // namespace
+
+Image syntheticImage(SyntheticPattern pattern, std::size_t width,
+                     std::size_t height, std::uint32_t seed) {
+    Image img(width, height);
+    img.fillByColor(WHITE);
+
+    switch (pattern) {
+        case SyntheticPattern::Circles: {
+            const Vector2 dimensions(width, height);
+            const std::size_t radius = std::min(width, height) / 6;
+            img.fillCircle(dimensions / 2, radius, BLACK);
+            img.fillCircle(dimensions / 2 - dimensions / 3, radius, BLACK);
+            img.fillCircle(dimensions / 2 + dimensions / 3, radius, BLACK);
+            break;
+        }
+        case SyntheticPattern::Gradient:
+            for (std::size_t y = 0; y < height; ++y) {
+                Color* row = img.row(y);
+                for (std::size_t x = 0; x < width; ++x)
+                    row[x] = gray(255 - x * 255 / std::max<std::size_t>(
+                                                       width - 1, 1));
+            }
+            break;
+        case SyntheticPattern::Checkerboard: {
+            const std::size_t side = std::max<std::size_t>(width / 16, 1);
+            for (std::size_t y = 0; y < height; ++y) {
+                Color* row = img.row(y);
+                for (std::size_t x = 0; x < width; ++x)
+                    if ((x / side + y / side) & 1) row[x] = BLACK;
+            }
+            break;
+        }
+        case SyntheticPattern::Noise: {
+            // xorshift32, never seeded with 0.
+            std::uint32_t state = seed * 2654435761u | 1;
+            for (std::size_t y = 0; y < height; ++y) {
+                Color* row = img.row(y);
+                for (std::size_t x = 0; x < width; ++x) {
+                    state ^= state << 13;
+                    state ^= state >> 17;
+                    state ^= state << 5;
+                    row[x] = gray(state >> 24);
+                }
+            }
+            break;
+        }
+    }
+
+    return img;
+}
+
+const char* syntheticName(SyntheticPattern pattern) {
+    switch (pattern) {
+        case SyntheticPattern::Circles: return "circles";
+        case SyntheticPattern::Gradient: return "gradient";
+        case SyntheticPattern::Checkerboard: return "checkerboard";
+        case SyntheticPattern::Noise: return "noise";
+    }
+    return "";
+}
+
+bool parseSyntheticPattern(const std::string name, SyntheticPattern& pattern) {
+    for (auto candidate : PATTERNS) {
+        if (name == syntheticName(candidate)) {
+            pattern = candidate;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,25 @@
+#ifndef STIPPLING_SYNTHETIC_
+#define STIPPLING_SYNTHETIC_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "image.hpp"
+
+// Generated test inputs, the same for the same arguments on every machine.
+enum class SyntheticPattern {
+    Circles,       // three black discs on white
+    Gradient,      // white to black, left to right
+    Checkerboard,  // 16 squares across
+    Noise          // independent random gray per pixel
+};
+
+Image syntheticImage(SyntheticPattern pattern, std::size_t width,
+                     std::size_t height, std::uint32_t seed = 0);
+
+const char* syntheticName(SyntheticPattern pattern);
+// Returns false if `name` is not one of the syntheticName.
+bool parseSyntheticPattern(const std::string name, SyntheticPattern& pattern);
+
+#endif  // STIPPLING_SYNTHETIC_
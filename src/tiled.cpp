@@ -0,0 +1,53 @@
+#include "tiled.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+TileCache::TileCache(std::size_t tiles, std::size_t tileBytes,
+                     std::size_t budget, const std::string directory)
+    : mapped(tiles, nullptr), position(tiles) {
+    // every tile starts on a page boundary, so that it can be mapped alone.
+    const std::size_t page = sysconf(_SC_PAGESIZE);
+    this->tileBytes = (tileBytes + page - 1) / page * page;
+    // two tiles are the least that allows copying between neighbours.
+    this->budget = std::max(budget, 2 * this->tileBytes);
+
+    std::string path = directory + "/stipple-tiles-XXXXXX";
+    fd = mkstemp(path.data());
+    if (fd < 0) throw "Could not create the tile file.\n";
+    unlink(path.c_str());
+
+    if (ftruncate(fd, (off_t)(tiles * this->tileBytes)) != 0) {
+        close(fd);
+        throw "Could not size the tile file.\n";
+    }
+}
+
+TileCache::~TileCache() {
+    for (void* tile : mapped)
+        if (tile) munmap(tile, tileBytes);
+    close(fd);
+}
+
+void TileCache::evict() {
+    std::size_t index = lru.back();
+    lru.pop_back();
+    munmap(mapped[index], tileBytes);
+    mapped[index] = nullptr;
+}
+
+void* TileCache::map(std::size_t index) {
+    while (!lru.empty() && (lru.size() + 1) * tileBytes > budget) evict();
+
+    void* tile = mmap(NULL, tileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                      (off_t)(index * tileBytes));
+    if (tile == MAP_FAILED) throw "Could not map a tile.\n";
+
+    mapped[index] = tile;
+    lru.push_front(index);
+    position[index] = lru.begin();
+    return tile;
+}
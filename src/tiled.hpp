@@ -0,0 +1,94 @@
+#ifndef STIPPLING_TILED_
+#define STIPPLING_TILED_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+
+constexpr std::size_t DEFAULT_TILE_SIZE = 256;
+
+// Square tiles of a plane, each stored in its own page aligned slot of an
+// (unlinked) temporary file and memory-mapped on demand. At most `budget`
+// bytes of tiles are mapped at any time, the least recently used tile is
+// unmapped first.
+class TileCache {
+   private:
+    int fd;
+    std::size_t tileBytes, budget;
+    std::vector<void*> mapped;
+    std::list<std::size_t> lru;
+    std::vector<std::list<std::size_t>::iterator> position;
+
+    void evict();
+
+   public:
+    TileCache(std::size_t tiles, std::size_t tileBytes, std::size_t budget,
+              const std::string directory);
+    ~TileCache();
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    // Pointer to the bytes of tile `index`, valid until the next call.
+    void* acquire(std::size_t index) {
+        if (mapped[index]) {
+            lru.splice(lru.begin(), lru, position[index]);
+            return mapped[index];
+        }
+        return map(index);
+    }
+    void* map(std::size_t index);
+
+    std::size_t getResidentBytes() const { return lru.size() * tileBytes; }
+};
+
+template <typename T>
+class TiledStore {
+   private:
+    std::size_t width, height, tileSize, tilesX, tilesY;
+    TileCache cache;
+
+    // last tile handed out, saves the LRU bookkeeping on the hot path.
+    std::size_t lastIndex = SIZE_MAX;
+    T* last = nullptr;
+
+   public:
+    TiledStore(std::size_t width, std::size_t height, std::size_t budget,
+               const std::string directory,
+               std::size_t tileSize = DEFAULT_TILE_SIZE)
+        : width(width),
+          height(height),
+          tileSize(tileSize),
+          tilesX((width + tileSize - 1) / tileSize),
+          tilesY((height + tileSize - 1) / tileSize),
+          cache(tilesX * tilesY, tileSize * tileSize * sizeof(T), budget,
+                directory) {}
+
+    std::size_t getWidth() const { return width; }
+    std::size_t getHeight() const { return height; }
+    std::size_t getTileSize() const { return tileSize; }
+    std::size_t getTilesX() const { return tilesX; }
+    std::size_t getTilesY() const { return tilesY; }
+
+    // Row major tile (tx, ty), each of its rows is `tileSize` elements long.
+    // The pointer stays valid until a different tile is requested.
+    T* tile(std::size_t tx, std::size_t ty) {
+        std::size_t index = ty * tilesX + tx;
+        if (index != lastIndex) {
+            last = (T*)cache.acquire(index);
+            lastIndex = index;
+        }
+        return last;
+    }
+
+    T& at(std::size_t x, std::size_t y) {
+        return tile(x / tileSize, y / tileSize)[(y % tileSize) * tileSize +
+                                                x % tileSize];
+    }
+
+    std::size_t getResidentBytes() const { return cache.getResidentBytes(); }
+};
+
+#endif  // STIPPLING_TILED_
@@ -0,0 +1,94 @@
+#include "trace.hpp"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "writer.hpp"
+
+namespace {
+
+struct Event {
+    const char* name;
+    std::int64_t begin, end;
+};
+
+// The events of one thread; owned by the registry so that they outlive the
+// thread, and only ever appended to by that thread.
+struct Track {
+    std::size_t id;
+    std::vector<Event> events;
+};
+
+std::mutex registryMutex;
+std::vector<std::unique_ptr<Track>> registry;
+std::chrono::steady_clock::time_point origin;
+
+Track& currentTrack() {
+    thread_local Track* track = nullptr;
+    if (!track) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.push_back(std::make_unique<Track>());
+        track = registry.back().get();
+        track->id = registry.size();
+    }
+    return *track;
+}
+
+}  // namespace
+
+void Tracer::enable() {
+    origin = std::chrono::steady_clock::now();
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+std::int64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - origin)
+        .count();
+}
+
+void Tracer::record(const char* name, std::int64_t begin, std::int64_t end) {
+    currentTrack().events.push_back({name, begin, end});
+}
+
+void Tracer::write(const std::string filename) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    BufferedWriter writer(filename);
+    writer.write("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    bool first = true;
+    auto separate = [&]() {
+        if (!first) writer.write(",\n");
+        first = false;
+    };
+
+    for (auto& track : registry) {
+        // the first track is the one of the thread that enabled tracing.
+        separate();
+        writer.write("{\"ph\": \"M\", \"pid\": 1, \"tid\": ");
+        writer.writeInteger(track->id);
+        writer.write(", \"name\": \"thread_name\", \"args\": {\"name\": \"");
+        writer.write(track->id == 1 ? "main" : "worker ");
+        if (track->id != 1) writer.writeInteger(track->id - 1);
+        writer.write("\"}}");
+
+        for (auto& event : track->events) {
+            separate();
+            writer.write("{\"ph\": \"X\", \"pid\": 1, \"tid\": ");
+            writer.writeInteger(track->id);
+            writer.write(", \"name\": \"");
+            writer.write(event.name);
+            writer.write("\", \"ts\": ");
+            writer.writeInteger(event.begin);
+            writer.write(", \"dur\": ");
+            writer.writeInteger(event.end - event.begin);
+            writer.put('}');
+        }
+    }
+
+    writer.write("\n]}\n");
+    writer.close();
+}
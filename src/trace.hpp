@@ -0,0 +1,55 @@
+#ifndef STIPPLING_TRACE_
+#define STIPPLING_TRACE_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped phase timers, written out as Chrome trace-event JSON (readable by
+// chrome://tracing and Perfetto), one track per thread. While tracing is
+// disabled a scope costs a single relaxed load.
+class Tracer {
+   private:
+    inline static std::atomic<bool> enabled{false};
+
+   public:
+    static bool isEnabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    static void enable();
+
+    // microseconds since tracing was enabled.
+    static std::int64_t now();
+    // `name` must outlive the tracer, i.e. be a string literal.
+    static void record(const char* name, std::int64_t begin,
+                       std::int64_t end);
+
+    // Writes every event recorded so far, by every thread.
+    static void write(const std::string filename);
+};
+
+class TraceScope {
+   private:
+    const char* name;
+    bool active;
+    std::int64_t begin = 0;
+
+   public:
+    explicit TraceScope(const char* name)
+        : name(name), active(Tracer::isEnabled()) {
+        if (active) begin = Tracer::now();
+    }
+    ~TraceScope() {
+        if (active) Tracer::record(name, begin, Tracer::now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Times the rest of the enclosing block as the phase `name`.
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif  // STIPPLING_TRACE_
@@ -0,0 +1,161 @@
+#include "vector_export.hpp"
+
+#include <cstdio>
+
+#include "writer.hpp"
+
+namespace {
+
+// [0, 1] intensity of a channel of a Color.
+inline double channel(Color color, int index) {
+    return ((color >> (8 * index)) & 0xFF) / 255.0;
+}
+
+}  // namespace
+
+void saveStipplesAsSVG(const std::vector<Vector2>& generators,
+                       const StippleStyle& style, const std::string filename) {
+    BufferedWriter writer(filename);
+
+    char fill[8];
+    snprintf(fill, sizeof(fill), "#%02x%02x%02x", (style.color >> 0) & 0xFF,
+             (style.color >> 8) & 0xFF, (style.color >> 16) & 0xFF);
+
+    writer.write("<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"");
+    writer.writeInteger(style.width);
+    writer.write("\" height=\"");
+    writer.writeInteger(style.height);
+    writer.write("\" viewBox=\"0 0 ");
+    writer.writeInteger(style.width);
+    writer.put(' ');
+    writer.writeInteger(style.height);
+    writer.write("\">\n<rect width=\"100%\" height=\"100%\" fill=\"#fff\"/>\n");
+    writer.write("<g fill=\"");
+    writer.write(fill);
+    writer.write("\">\n");
+
+    for (auto& generator : generators) {
+        writer.write("<circle cx=\"");
+        writer.writeNumber(style.centerX(generator));
+        writer.write("\" cy=\"");
+        writer.writeNumber(style.centerY(generator));
+        writer.write("\" r=\"");
+        writer.writeNumber(style.radius);
+        writer.write("\"/>\n");
+    }
+
+    writer.write("</g>\n</svg>\n");
+    writer.close();
+}
+
+void saveStipplesAsEPS(const std::vector<Vector2>& generators,
+                       const StippleStyle& style, const std::string filename) {
+    BufferedWriter writer(filename);
+
+    writer.write("%!PS-Adobe-3.0 EPSF-3.0\n%%BoundingBox: 0 0 ");
+    writer.writeInteger(style.width);
+    writer.put(' ');
+    writer.writeInteger(style.height);
+    writer.write("\n%%EndComments\n");
+
+    // `x y d` draws a dot, the y axis of postscript points upwards.
+    writer.write("/d { newpath ");
+    writer.writeNumber(style.radius);
+    writer.write(" 0 360 arc fill } bind def\n");
+
+    writer.write("1 1 1 setrgbcolor 0 0 ");
+    writer.writeInteger(style.width);
+    writer.put(' ');
+    writer.writeInteger(style.height);
+    writer.write(" rectfill\n");
+    for (int i = 0; i < 3; ++i) {
+        writer.writeNumber(channel(style.color, i), 3);
+        writer.put(' ');
+    }
+    writer.write("setrgbcolor\n");
+
+    for (auto& generator : generators) {
+        writer.writeNumber(style.centerX(generator));
+        writer.put(' ');
+        writer.writeNumber(style.height - style.centerY(generator));
+        writer.write(" d\n");
+    }
+
+    writer.write("showpage\n%%EOF\n");
+    writer.close();
+}
+
+void saveStipplesAsPDF(const std::vector<Vector2>& generators,
+                       const StippleStyle& style, const std::string filename) {
+    BufferedWriter writer(filename);
+
+    // byte offsets of the objects 1 to 5, for the cross reference table.
+    std::size_t offsets[6] = {0};
+
+    writer.write("%PDF-1.4\n");
+
+    offsets[1] = writer.tell();
+    writer.write("1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+
+    offsets[2] = writer.tell();
+    writer.write("2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n");
+
+    offsets[3] = writer.tell();
+    writer.write("3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 ");
+    writer.writeInteger(style.width);
+    writer.put(' ');
+    writer.writeInteger(style.height);
+    writer.write("] /Contents 4 0 R >>\nendobj\n");
+
+    // the length of the content stream is only known once it is written, so
+    // it is stored in the indirect object 5.
+    offsets[4] = writer.tell();
+    writer.write("4 0 obj\n<< /Length 5 0 R >>\nstream\n");
+    const std::size_t streamStart = writer.tell();
+
+    writer.write("1 1 1 rg 0 0 ");
+    writer.writeInteger(style.width);
+    writer.put(' ');
+    writer.writeInteger(style.height);
+    writer.write(" re f\n");
+    for (int i = 0; i < 3; ++i) {
+        writer.writeNumber(channel(style.color, i), 3);
+        writer.put(' ');
+    }
+    // every dot is a zero length segment stroked with round caps, whose
+    // diameter is the line width.
+    writer.write("RG 1 J ");
+    writer.writeNumber(2 * style.radius);
+    writer.write(" w\n");
+
+    for (auto& generator : generators) {
+        for (int i = 0; i < 2; ++i) {
+            writer.writeNumber(style.centerX(generator));
+            writer.put(' ');
+            writer.writeNumber(style.height - style.centerY(generator));
+            writer.write(i ? " l\n" : " m ");
+        }
+    }
+    writer.write("S\n");
+
+    const std::size_t streamLength = writer.tell() - streamStart;
+    writer.write("endstream\nendobj\n");
+
+    offsets[5] = writer.tell();
+    writer.write("5 0 obj\n");
+    writer.writeInteger(streamLength);
+    writer.write("\nendobj\n");
+
+    const std::size_t xref = writer.tell();
+    writer.write("xref\n0 6\n0000000000 65535 f \n");
+    for (int i = 1; i <= 5; ++i) {
+        char entry[24];
+        snprintf(entry, sizeof(entry), "%010zu 00000 n \n", offsets[i]);
+        writer.write(entry);
+    }
+    writer.write("trailer\n<< /Size 6 /Root 1 0 R >>\nstartxref\n");
+    writer.writeInteger(xref);
+    writer.write("\n%%EOF\n");
+
+    writer.close();
+}
@@ -0,0 +1,37 @@
+#ifndef STIPPLING_VECTOR_EXPORT_
+#define STIPPLING_VECTOR_EXPORT_
+
+#include <string>
+#include <vector>
+
+#include "Vector2.hpp"
+#include "image.hpp"
+
+// How the generator points are drawn on a `width` x `height` canvas. The
+// points are in the pixels of the grid they were computed on, which maps to
+// the canvas by `scaleX` and `scaleY`; the radius is in canvas pixels.
+struct StippleStyle {
+    std::size_t width, height;
+    double radius;
+    Color color;
+    double scaleX = 1, scaleY = 1;
+
+    // canvas position of the pixel center of `generator`.
+    double centerX(Vector2 generator) const {
+        return (generator.x + 0.5) * scaleX;
+    }
+    double centerY(Vector2 generator) const {
+        return (generator.y + 0.5) * scaleY;
+    }
+};
+
+// Writers of the generator points as vector drawings, with one filled circle
+// per generator over a white background.
+void saveStipplesAsSVG(const std::vector<Vector2>& generators,
+                       const StippleStyle& style, const std::string filename);
+void saveStipplesAsEPS(const std::vector<Vector2>& generators,
+                       const StippleStyle& style, const std::string filename);
+void saveStipplesAsPDF(const std::vector<Vector2>& generators,
+                       const StippleStyle& style, const std::string filename);
+
+#endif  // STIPPLING_VECTOR_EXPORT_
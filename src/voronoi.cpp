@@ -1,45 +1,182 @@
 #include "voronoi.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <queue>
 
 #include "Vector2.hpp"
+#include "kernels.hpp"
+#include "parallel.hpp"
+#include "random.hpp"
+#include "trace.hpp"
+
+namespace {
+
+// Generators sorted into square buckets, for nearest generator queries.
+class GeneratorBuckets {
+   private:
+    const std::vector<Vector2>& generators;
+    std::int32_t size, bucketsX, bucketsY;
+    // generators of bucket i are indices[start[i] .. start[i + 1]), with
+    // their coordinates in xs and ys at the same positions.
+    std::vector<std::uint32_t> start, indices;
+    std::vector<std::int32_t> xs, ys;
+
+    // The buckets [bx0, bx1] of row `by` are contiguous.
+    void visit(std::int32_t bx0, std::int32_t bx1, std::int32_t by,
+               Vector2 coord, std::uint64_t& best,
+               std::size_t& nearest) const {
+        if (by < 0 || by >= bucketsY) return;
+        bx0 = std::max(bx0, 0);
+        bx1 = std::min(bx1, bucketsX - 1);
+        if (bx0 > bx1) return;
+        const std::uint32_t first = start[by * bucketsX + bx0],
+                            last = start[by * bucketsX + bx1 + 1];
+        nearestGenerator(xs.data() + first, ys.data() + first,
+                         indices.data() + first, last - first, coord.x,
+                         coord.y, best, nearest);
+    }
 
-inline std::int32_t get_random(std::int32_t from, std::int32_t to) {
-    return rand() % (to - from) + from;
-}
+   public:
+    GeneratorBuckets(const std::vector<Vector2>& generators, Vector2 dimensions)
+        : generators(generators) {
+        // about two generators per bucket.
+        const double area = 1.0 * dimensions.x * dimensions.y;
+        const double count = std::max<std::size_t>(generators.size(), 1);
+        size = std::max<std::int32_t>(1, std::sqrt(2 * area / count));
+        bucketsX = (dimensions.x + size - 1) / size;
+        bucketsY = (dimensions.y + size - 1) / size;
+
+        start.assign(1ULL * bucketsX * bucketsY + 1, 0);
+        for (auto& generator : generators)
+            ++start[(generator.y / size) * bucketsX + generator.x / size + 1];
+        for (std::size_t i = 1; i < start.size(); ++i) start[i] += start[i - 1];
+
+        indices.resize(generators.size());
+        xs.resize(generators.size());
+        ys.resize(generators.size());
+        std::vector<std::uint32_t> fill(start.begin(), start.end() - 1);
+        for (std::size_t i = 0; i < generators.size(); ++i) {
+            const Vector2& generator = generators[i];
+            const std::size_t bucket =
+                (generator.y / size) * bucketsX + generator.x / size;
+            xs[fill[bucket]] = generator.x;
+            ys[fill[bucket]] = generator.y;
+            indices[fill[bucket]++] = i;
+        }
+    }
+
+    // Index of the generator nearest to `coord`, the lowest index on ties.
+    std::size_t nearest(Vector2 coord) const {
+        const std::int32_t bx = coord.x / size, by = coord.y / size;
+        std::uint64_t best = UINT64_MAX;
+        std::size_t nearest = generators.size();
+
+        visit(bx, bx, by, coord, best, nearest);
+        for (std::int32_t r = 1;; ++r) {
+            // everything left is at least r buckets away, i.e. farther
+            // than r * size from coord.
+            const std::uint64_t reach = 1ULL * (r - 1) * size;
+            if (best < reach * reach) break;
+            if (r > bucketsX && r > bucketsY) break;
+
+            visit(bx - r, bx + r, by - r, coord, best, nearest);
+            visit(bx - r, bx + r, by + r, coord, best, nearest);
+            for (std::int32_t d = -r + 1; d <= r - 1; ++d) {
+                visit(bx - r, bx - r, by + d, coord, best, nearest);
+                visit(bx + r, bx + r, by + d, coord, best, nearest);
+            }
+        }
+
+        return nearest;
+    }
+};
 
-inline std::int32_t get_random_region(std::int32_t center,
-                                      std::int32_t distance) {
-    return get_random(center - distance, center + distance);
+// `height` rows of `width` times `value`, in the storage `grid` already has.
+template <typename T>
+void reset(Grid<T>& grid, std::size_t width, std::size_t height, T value) {
+    grid.resize(height);
+    for (auto& row : grid) row.assign(width, value);
 }
 
-inline Vector2 get_random_region(Vector2 center, Vector2 distance) {
-    return Vector2(get_random_region(center.x, distance.x),
-                   get_random_region(center.y, distance.y));
+// Rows per band of the nearest generator labelling, handed out to threads.
+constexpr std::size_t LABEL_BAND_ROWS = 16;
+// Cells per block of the centroids, handed out to threads.
+constexpr std::size_t CENTROID_BLOCK = 1024;
+
+// Row spans of every one of `cells` labels of `scratch.labels` (within
+// `mask`, when given) into `scratch.boundaries`; labels from `cells` on are
+// left out.
+void extractSpans(Vector2 dimensions, std::size_t cells,
+                  VoronoiScratch& scratch, Image* boundaryImage,
+                  const DomainMask* mask) {
+    TRACE_SCOPE("spans");
+    const Grid<std::size_t>& voronoiImage = scratch.labels;
+    std::vector<VoronoiBoundary>& boundaries = scratch.boundaries;
+    boundaries.resize(cells);
+    for (auto& boundary : boundaries) boundary.clear();
+
+    // without a mask, every row is a single run.
+    const DomainMask::Run whole{0, dimensions.x};
+    for (std::int32_t y = 0; y < dimensions.y; ++y) {
+        const DomainMask::Run* run = mask ? mask->rowBegin(y) : &whole;
+        const DomainMask::Run* end = mask ? mask->rowEnd(y) : &whole + 1;
+        const std::size_t* labels = voronoiImage[y].data();
+        for (; run != end; ++run) {
+            // one span per run of equal labels, but none of unreached ones.
+            for (std::int32_t x = run->begin; x < run->end;) {
+                const std::int32_t next = labelRunEnd(labels, x, run->end);
+                if (labels[x] < cells) {
+                    boundaries[labels[x]].push_back(
+                        {Vector2(x, y), Vector2(next - 1, y)});
+                    if (boundaryImage)
+                        boundaryImage->fillPoint(Vector2(x, y), BLUE);
+                }
+                x = next;
+            }
+        }
+    }
+
+    scratch.spansCharge.resize(tableBytes(boundaries));
 }
 
-std::vector<Vector2> randomizeGenerators(std::size_t N, Vector2 max) {
+}  // namespace
+
+std::vector<Vector2> randomizeGenerators(std::size_t N, Vector2 max,
+                                         Random& random) {
     std::vector<Vector2> generators;
     for (std::size_t i = 0; i < N; ++i)
-        generators.push_back(Vector2(rand() % max.x, rand() % max.y));
+        generators.push_back(
+            Vector2(random.next() % max.x, random.next() % max.y));
     return generators;
 }
 
-std::vector<Vector2> rejectionSampling(std::size_t N, Image& img) {
-    Grid<double> darkness(img.getHeight(), std::vector<double>(img.getWidth()));
-    for (std::size_t y = 0; y < img.getHeight(); ++y)
-        for (std::size_t x = 0; x < img.getWidth(); ++x)
-            darkness[y][x] = Image::getDarkness(img.getColor(Vector2(x, y)));
+std::vector<Vector2> randomizeGenerators(std::size_t N, const DomainMask& mask,
+                                         Random& random) {
+    std::vector<Vector2> generators;
+    if (!mask.getArea()) return generators;
+    for (std::size_t i = 0; i < N; ++i)
+        generators.push_back(mask.sample(random));
+    return generators;
+}
 
+std::vector<Vector2> rejectionSampling(std::size_t N,
+                                       const DensityMap& density,
+                                       Random& random,
+                                       const DomainMask* mask) {
     std::vector<Vector2> acceptedGenerators;
 
-    Vector2 dimensions(img.getWidth(), img.getHeight());
+    Vector2 dimensions(density.getWidth(), density.getHeight());
+    if (mask && !mask->getArea()) return acceptedGenerators;
 
     while (acceptedGenerators.size() < N) {
+        const std::size_t missing = N - acceptedGenerators.size();
         // sample uniformly & check if their pdf is lesser than darkness.
-        for (auto sample : randomizeGenerators(N - acceptedGenerators.size(), dimensions)) {
-            if (rand() % 256 <= darkness[sample.y][sample.x])
+        for (auto sample :
+             mask ? randomizeGenerators(missing, *mask, random)
+                  : randomizeGenerators(missing, dimensions, random)) {
+            if (random.next() % 256 <= density.getDensity(sample))
                 acceptedGenerators.push_back(sample);
         }
     }
@@ -47,20 +184,230 @@ std::vector<Vector2> rejectionSampling(std::size_t N, Image& img) {
     return acceptedGenerators;
 }
 
+std::vector<Vector2> errorDiffusionSampling(std::size_t N,
+                                            const DensityMap& density,
+                                            Random& random,
+                                            const DomainMask* mask) {
+    const std::size_t width = density.getWidth(), height = density.getHeight();
+
+    long double total = 0;
+    for (std::size_t y = 0; y < height; ++y)
+        for (std::size_t x = 0; x < width; ++x) total += density.row(y)[x];
+    if (!(total > 0) || !width) return {};
+
+    // every pixel carries `scale * darkness` dots, so the whole image carries N.
+    const double scale = N / total;
+
+    // error carried into the current and the next row, padded by one pixel on
+    // both sides so that the kernel never needs a bounds check.
+    std::vector<double> current(width + 2, 0.0), next(width + 2, 0.0);
+
+    std::vector<Vector2> generators;
+    generators.reserve(N + N / 8);
+    std::vector<bool> inside(width, true);
+    for (std::size_t y = 0; y < height; ++y) {
+        const float* darkness = density.row(y);
+        const bool reversed = y & 1;
+        const std::int32_t step = reversed ? -1 : 1;
+
+        if (mask) {
+            inside.assign(width, false);
+            for (auto run = mask->rowBegin(y); run != mask->rowEnd(y); ++run)
+                std::fill(inside.begin() + run->begin,
+                          inside.begin() + run->end, true);
+        }
+
+        for (std::size_t i = 0; i < width; ++i) {
+            const std::size_t x = reversed ? width - 1 - i : i;
+            const std::size_t p = x + 1;
+            if (!inside[x]) continue;
+
+            double value = darkness[x] * scale + current[p];
+            if (value >= 0.5) {
+                generators.push_back(Vector2(x, y));
+                value -= 1.0;
+            }
+
+            current[p + step] += value * 7 / 16;
+            next[p - step] += value * 3 / 16;
+            next[p] += value * 5 / 16;
+            next[p + step] += value * 1 / 16;
+        }
+
+        std::swap(current, next);
+        std::fill(next.begin(), next.end(), 0.0);
+    }
+
+    if (generators.size() > N) {
+        // drop evenly spread dots, so no region of the image is favoured.
+        const std::size_t excess = generators.size() - N;
+        std::vector<Vector2> kept;
+        kept.reserve(N);
+        for (std::size_t i = 0, dropped = 0; i < generators.size(); ++i) {
+            if (dropped < excess &&
+                i == (dropped * generators.size()) / excess) {
+                ++dropped;
+                continue;
+            }
+            kept.push_back(generators[i]);
+        }
+        generators.swap(kept);
+    } else if (generators.size() < N) {
+        for (auto& sample :
+             rejectionSampling(N - generators.size(), density, random, mask))
+            generators.push_back(sample);
+    }
+
+    return generators;
+}
+
+std::vector<Vector2> streamingSampling(std::size_t N, DensityBandReader& reader,
+                                       std::size_t bandRows, Random& random) {
+    TRACE_SCOPE("sampling");
+    const std::size_t width = reader.getWidth(), height = reader.getHeight();
+    bandRows = std::max<std::size_t>(bandRows, 1);
+    const std::size_t bands = (height + bandRows - 1) / bandRows;
+
+    std::vector<float> band;
+
+    std::vector<long double> mass(bands, 0.0);
+    long double total = 0;
+    for (std::size_t b = 0; b < bands; ++b) {
+        const std::size_t rows = std::min(bandRows, height - b * bandRows);
+        reader.read(b * bandRows, rows, band);
+        for (auto darkness : band) mass[b] += darkness;
+        total += mass[b];
+    }
+    if (!(total > 0)) return {};
+
+    // largest remainder apportionment of N among the bands.
+    std::vector<std::size_t> share(bands);
+    std::vector<std::pair<long double, std::size_t>> remainders(bands);
+    std::size_t assigned = 0;
+    for (std::size_t b = 0; b < bands; ++b) {
+        long double exact = N * mass[b] / total;
+        share[b] = (std::size_t)exact;
+        remainders[b] = {exact - share[b], b};
+        assigned += share[b];
+    }
+    std::sort(remainders.rbegin(), remainders.rend());
+    for (std::size_t i = 0; assigned < N; ++i, ++assigned)
+        ++share[remainders[i % bands].second];
+
+    std::vector<Vector2> generators;
+    generators.reserve(N);
+
+    std::vector<long double> cdf;
+    for (std::size_t b = 0; b < bands; ++b) {
+        if (!share[b]) continue;
+
+        const std::size_t rows = std::min(bandRows, height - b * bandRows);
+        reader.read(b * bandRows, rows, band);
+
+        cdf.resize(band.size());
+        long double running = 0;
+        for (std::size_t i = 0; i < band.size(); ++i)
+            cdf[i] = running += band[i];
+
+        for (std::size_t i = 0; i < share[b]; ++i) {
+            long double target =
+                running * (random.next() / (Random::MAX + 1.0L));
+            std::size_t index =
+                std::upper_bound(cdf.begin(), cdf.end(), target) - cdf.begin();
+            index = std::min(index, cdf.size() - 1);
+
+            generators.push_back(
+                Vector2(index % width, b * bandRows + index / width));
+        }
+    }
+
+    return generators;
+}
+
+std::vector<Vector2> lowDiscrepancySampling(std::size_t N,
+                                            const PrefixFunction& P) {
+    // source: https://extremelearning.com.au/unreasonable-effectiveness-of-quasirandom-sequences/
+    constexpr double PLASTIC = 1.32471795724474602596;
+    constexpr double ALPHA_1 = 1.0 / PLASTIC;
+    constexpr double ALPHA_2 = 1.0 / (PLASTIC * PLASTIC);
+
+    const std::size_t height = P.size(), width = height ? P[0].size() : 0;
+    if (!width) return {};
+
+    // cumulative mass of the rows, i.e. the marginal along y.
+    std::vector<long double> rows(height);
+    for (std::size_t y = 0; y < height; ++y)
+        rows[y] = (y ? rows[y - 1] : 0.0) + P[y][width - 1];
+
+    std::vector<Vector2> generators;
+    generators.reserve(N);
+    for (std::size_t i = 0; i < N; ++i) {
+        double u = 0.5 + ALPHA_1 * (i + 1), v = 0.5 + ALPHA_2 * (i + 1);
+        u -= std::floor(u);
+        v -= std::floor(v);
+
+        std::size_t y = std::upper_bound(rows.begin(), rows.end(),
+                                         v * rows.back()) -
+                        rows.begin();
+        y = std::min(y, height - 1);
+
+        std::size_t x = std::lower_bound(P[y].begin(), P[y].end(),
+                                         u * P[y][width - 1]) -
+                        P[y].begin();
+        x = std::min(x, width - 1);
+
+        generators.push_back(Vector2(x, y));
+    }
+
+    return generators;
+}
+
 bool operator<(const Vector2& A, const Vector2& B) {
     return A.length() < B.length();
 }
 
-Grid<std::size_t> getVoronoiDiagram(Image& img,
-                                    std::vector<Vector2>& generators) {
+void getVoronoiDiagram(Vector2 dimensions, std::vector<Vector2>& generators,
+                       VoronoiScratch& scratch, const DomainMask* mask) {
+    TRACE_SCOPE("labelling");
     static Vector2 dir4[]{{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
 
-    const std::uint32_t width = img.getWidth(), height = img.getHeight();
-
-    Grid<std::size_t> voronoiImage(height, std::vector<std::size_t>(width, 0));
-    Grid<bool> visited(height, std::vector<bool>(width, false));
+    const std::uint32_t width = dimensions.x, height = dimensions.y;
+
+    Grid<std::size_t>& voronoiImage = scratch.labels;
+    Grid<bool>& visited = scratch.visited;
+    // pixels no generator reaches keep this label.
+    const std::size_t unreached = generators.size();
+    if (mask && scratch.visitedMask && *scratch.visitedMask == *mask &&
+        visited.size() == height && (!height || visited[0].size() == width)) {
+        // the pixels outside are still visited from the last step.
+        for (std::uint32_t y = 0; y < height; ++y)
+            for (auto run = mask->rowBegin(y); run != mask->rowEnd(y);
+                 ++run) {
+                std::fill(voronoiImage[y].begin() + run->begin,
+                          voronoiImage[y].begin() + run->end, unreached);
+                std::fill(visited[y].begin() + run->begin,
+                          visited[y].begin() + run->end, false);
+            }
+    } else {
+        reset(voronoiImage, width, height, unreached);
+        reset(visited, width, height, false);
+        scratch.labelsCharge.resize(tableBytes(voronoiImage));
+        scratch.visitedCharge.resize(tableBytes(visited));
+        // the pixels outside of the mask count as visited from the start.
+        for (std::uint32_t y = 0; mask && y < height; ++y) {
+            std::fill(visited[y].begin(), visited[y].end(), true);
+            for (auto run = mask->rowBegin(y); run != mask->rowEnd(y); ++run)
+                std::fill(visited[y].begin() + run->begin,
+                          visited[y].begin() + run->end, false);
+        }
+        if (mask)
+            scratch.visitedMask.emplace(*mask);
+        else
+            scratch.visitedMask.reset();
+    }
 
-    std::priority_queue<std::pair<std::int64_t, std::pair<Vector2, Vector2>>> Q;
+    FloodQueue& Q = scratch.queue;
+    Q.clear();
 
     for (std::size_t i = 0; i < generators.size(); ++i) {
         Q.push({0, {generators[i], generators[i]}});
@@ -89,66 +436,179 @@ Grid<std::size_t> getVoronoiDiagram(Image& img,
         }
     }
 
-    return voronoiImage;
+    // the queue never shrinks, its capacity is its peak.
+    scratch.queueCharge.resize(Q.bytes());
 }
 
-std::vector<VoronoiBoundary> getVoronoiBoundaries(
-    Image& img, std::vector<Vector2>& generators, bool drawBoundaries) {
-    std::vector<VoronoiBoundary> boundaries(generators.size());
-
-    Grid<std::size_t> voronoiImage = getVoronoiDiagram(img, generators);
-
-    for (std::size_t y = 0; y < img.getHeight(); ++y) {
-        std::size_t previousGenerator = generators.size();
-        for (std::size_t x = 0; x < img.getWidth(); ++x) {
-            Vector2 coord(x, y);
-
-            std::size_t minIdx = voronoiImage[y][x];
-
-            if (previousGenerator != minIdx) {
-                boundaries[minIdx].push_back({coord, coord});
-
-                if (drawBoundaries) img.fillPoint(coord, BLUE);
+Grid<std::size_t> getVoronoiDiagram(Vector2 dimensions,
+                                    std::vector<Vector2>& generators,
+                                    const DomainMask* mask) {
+    VoronoiScratch scratch;
+    getVoronoiDiagram(dimensions, generators, scratch, mask);
+    return std::move(scratch.labels);
+}
 
-                if (previousGenerator < generators.size())
-                    boundaries[previousGenerator].back().second.x = coord.x - 1;
-            }
+void getVoronoiBoundaries(Vector2 dimensions, std::vector<Vector2>& generators,
+                          VoronoiScratch& scratch, Image* boundaryImage,
+                          const DomainMask* mask) {
+    getVoronoiDiagram(dimensions, generators, scratch, mask);
+    extractSpans(dimensions, generators.size(), scratch, boundaryImage, mask);
+}
 
-            previousGenerator = minIdx;
+void getNearestBoundaries(Vector2 dimensions,
+                          const std::vector<Vector2>& generators,
+                          VoronoiScratch& scratch, const DomainMask* mask,
+                          unsigned threads) {
+    {
+        TRACE_SCOPE("labelling");
+        const std::size_t width = dimensions.x, height = dimensions.y;
+        Grid<std::size_t>& labels = scratch.labels;
+        if (labels.size() != height || (height && labels[0].size() != width))
+            reset(labels, width, height, generators.size());
+        scratch.labelsCharge.resize(tableBytes(labels));
+
+        if (!generators.empty()) {
+            const GeneratorBuckets buckets(generators, dimensions);
+            // every pixel is labelled on its own, the bands only spread them
+            // over the threads.
+            const std::size_t bands =
+                (height + LABEL_BAND_ROWS - 1) / LABEL_BAND_ROWS;
+            parallelFor(bands, threads, [&](std::size_t band) {
+                TRACE_SCOPE("labelling band");
+                const std::size_t last =
+                    std::min(height, (band + 1) * LABEL_BAND_ROWS);
+                for (std::size_t y = band * LABEL_BAND_ROWS; y < last; ++y) {
+                    const DomainMask::Run whole{0, dimensions.x};
+                    const DomainMask::Run* run =
+                        mask ? mask->rowBegin(y) : &whole;
+                    const DomainMask::Run* end =
+                        mask ? mask->rowEnd(y) : &whole + 1;
+                    for (; run != end; ++run)
+                        for (std::int32_t x = run->begin; x < run->end; ++x)
+                            labels[y][x] = buckets.nearest(Vector2(x, y));
+                }
+            });
         }
-        if (previousGenerator < generators.size())
-            boundaries[previousGenerator].back().second =
-                Vector2(img.getWidth() - 1, y);
     }
+    extractSpans(dimensions, generators.size(), scratch, nullptr, mask);
+}
 
-    return boundaries;
+std::vector<VoronoiBoundary> getVoronoiBoundaries(
+    Vector2 dimensions, std::vector<Vector2>& generators, Image* boundaryImage,
+    const DomainMask* mask) {
+    VoronoiScratch scratch;
+    getVoronoiBoundaries(dimensions, generators, scratch, boundaryImage, mask);
+    return std::move(scratch.boundaries);
 }
 
 std::vector<Vector2> computeVoronoiCenters(
     std::vector<VoronoiBoundary>& boundaries,
-    std::pair<PrefixFunction, PrefixFunction> prefixFunctions) {
-    std::vector<Vector2> generators;
-
-    for (auto& boundary : boundaries) {
-        long double yNumerator = 0, xNumerator = 0, denominator = 0;
+    const std::pair<PrefixFunction, PrefixFunction>& prefixFunctions,
+    unsigned threads) {
+    TRACE_SCOPE("centroids");
+    // every cell on its own, then the ones without mass are dropped in order.
+    std::vector<Vector2> centers(boundaries.size(), Vector2(0, 0));
+    std::vector<char> kept(boundaries.size(), false);
+
+    const std::size_t blocks =
+        (boundaries.size() + CENTROID_BLOCK - 1) / CENTROID_BLOCK;
+    parallelFor(blocks, threads, [&](std::size_t block) {
+        const std::size_t last =
+            std::min(boundaries.size(), (block + 1) * CENTROID_BLOCK);
+        for (std::size_t i = block * CENTROID_BLOCK; i < last; ++i) {
+            long double yNumerator = 0, xNumerator = 0, denominator = 0;
+            // bounding box of the cell, the centroid cannot be outside of it.
+            std::int32_t left = INT32_MAX, right = INT32_MIN, top = INT32_MAX,
+                         bottom = INT32_MIN;
+
+            for (auto& [p1, p2] : boundaries[i]) {
+                assert(p1.y == p2.y);
+                left = std::min(left, p1.x);
+                right = std::max(right, p2.x);
+                top = std::min(top, p1.y);
+                bottom = std::max(bottom, p1.y);
+
+                xNumerator +=
+                    prefixFunctions.second[p2.y][p2.x] -
+                    (p1.x ? prefixFunctions.second[p1.y][p1.x - 1] : 0.0);
+                yNumerator +=
+                    p1.y *
+                    (prefixFunctions.first[p2.y][p2.x] -
+                     (p1.x ? prefixFunctions.first[p1.y][p1.x - 1] : 0.0));
+                denominator +=
+                    prefixFunctions.first[p2.y][p2.x] -
+                    (p1.x ? prefixFunctions.first[p1.y][p1.x - 1] : 0.0);
+            }
 
-        for (auto& [p1, p2] : boundary) {
-            assert(p1.y == p2.y);
+            if (!(denominator > 0)) continue;
 
-            xNumerator += prefixFunctions.second[p2.y][p2.x] -
-                          (p1.x ? prefixFunctions.second[p1.y][p1.x - 1] : 0.0);
-            yNumerator +=
-                p1.y * (prefixFunctions.first[p2.y][p2.x] -
-                        (p1.x ? prefixFunctions.first[p1.y][p1.x - 1] : 0.0));
-            denominator += prefixFunctions.first[p2.y][p2.x] -
-                           (p1.x ? prefixFunctions.first[p1.y][p1.x - 1] : 0.0);
+            // the prefix sums of large darkness values lose precision, which
+            // can throw the quotients far off.
+            centers[i] = Vector2(
+                std::clamp<long double>(xNumerator / denominator, left, right),
+                std::clamp<long double>(yNumerator / denominator, top,
+                                        bottom));
+            kept[i] = true;
         }
+    });
 
-        if (!(denominator > 0)) continue;
+    std::vector<Vector2> generators;
+    for (std::size_t i = 0; i < centers.size(); ++i)
+        if (kept[i]) generators.push_back(centers[i]);
+    return generators;
+}
 
-        generators.push_back(
-            Vector2(xNumerator / denominator, yNumerator / denominator));
+std::vector<Vector2> computeTiledVoronoiCenters(
+    TiledDensity& density, const std::vector<Vector2>& generators,
+    const DomainMask* mask) {
+    TRACE_SCOPE("centroids");
+    const std::size_t width = density.getWidth(), height = density.getHeight(),
+                      tileSize = density.getTileSize();
+    if (generators.empty()) return {};
+
+    const GeneratorBuckets buckets(generators, Vector2(width, height));
+
+    struct Moments {
+        long double mass = 0, x = 0, y = 0;
+    };
+    std::vector<Moments> moments(generators.size());
+
+    for (std::size_t ty = 0; ty < density.getTilesY(); ++ty) {
+        for (std::size_t tx = 0; tx < density.getTilesX(); ++tx) {
+            const float* tile = density.tile(tx, ty);
+            const std::size_t rows = std::min(tileSize, height - ty * tileSize);
+            const std::size_t columns =
+                std::min(tileSize, width - tx * tileSize);
+
+            const std::int32_t left = tx * tileSize, right = left + columns;
+            for (std::size_t r = 0; r < rows; ++r) {
+                const std::int32_t y = ty * tileSize + r;
+                const DomainMask::Run whole{left, right};
+                const DomainMask::Run* run = mask ? mask->rowBegin(y) : &whole;
+                const DomainMask::Run* end =
+                    mask ? mask->rowEnd(y) : &whole + 1;
+                for (; run != end; ++run) {
+                    const std::int32_t from = std::max(left, run->begin),
+                                       to = std::min(right, run->end);
+                    for (std::int32_t x = from; x < to; ++x) {
+                        const float darkness = tile[r * tileSize + x - left];
+
+                        Moments& cell =
+                            moments[buckets.nearest(Vector2(x, y))];
+                        cell.mass += darkness;
+                        cell.x += (long double)darkness * x;
+                        cell.y += (long double)darkness * y;
+                    }
+                }
+            }
+        }
     }
 
-    return generators;
+    std::vector<Vector2> centers;
+    for (auto& cell : moments) {
+        if (!(cell.mass > 0)) continue;
+        centers.push_back(Vector2(cell.x / cell.mass, cell.y / cell.mass));
+    }
+
+    return centers;
 }
@@ -2,27 +2,130 @@
 #define STIPPLING_VORONOI_
 
 #include <cstdint>
+#include <optional>
+#include <queue>
+#include <utility>
 #include <vector>
 
 #include "Vector2.hpp"
+#include "density.hpp"
 #include "image.hpp"
+#include "mask.hpp"
+#include "memory.hpp"
+#include "random.hpp"
 
 template <typename T>
 using Grid = std::vector<std::vector<T>>;
 
 typedef std::vector<std::pair<Vector2, Vector2>> VoronoiBoundary;
 
-std::vector<Vector2> randomizeGenerators(std::size_t N, Vector2 max);
-std::vector<Vector2> rejectionSampling(std::size_t N, Image& img);
+// Pixels still to be labelled by the flood fill, closest to the generator of
+// their parent first.
+class FloodQueue
+    : public std::priority_queue<
+          std::pair<std::int64_t, std::pair<Vector2, Vector2>>> {
+   public:
+    // empties the queue, but keeps its storage.
+    void clear() { c.clear(); }
+    std::size_t bytes() const { return c.capacity() * sizeof(value_type); }
+};
 
-Grid<std::size_t> getVoronoiDiagram(Image& img,
-                                    std::vector<Vector2>& generators);
+// Buffers of a relaxation step. Kept from one step (or image of a similar
+// size) to the next, they are only allocated once.
+struct VoronoiScratch {
+    Grid<std::size_t> labels;
+    Grid<bool> visited;
+    // the mask `visited` holds outside of, so that the next step with the
+    // same mask only resets the pixels inside.
+    std::optional<DomainMask> visitedMask;
+    FloodQueue queue;
+    std::vector<VoronoiBoundary> boundaries;
 
+    MemoryCharge labelsCharge{Subsystem::LabelGrid},
+        visitedCharge{Subsystem::VisitedGrid},
+        queueCharge{Subsystem::PriorityQueue}, spansCharge{Subsystem::Spans};
+};
+
+// Every initialisation only places generators inside `mask`, when given.
+// The density based ones rely on the darkness being cleared outside of it
+// (see MaskedBandReader), the others take the mask. The random ones draw
+// from `random` only, so that they can run concurrently.
+std::vector<Vector2> randomizeGenerators(std::size_t N, Vector2 max,
+                                         Random& random);
+std::vector<Vector2> randomizeGenerators(std::size_t N, const DomainMask& mask,
+                                         Random& random);
+std::vector<Vector2> rejectionSampling(std::size_t N,
+                                       const DensityMap& density,
+                                       Random& random,
+                                       const DomainMask* mask = nullptr);
+
+// Serpentine Floyd-Steinberg error diffusion of the darkness, scaled so that
+// about N dots are produced, then trimmed (or topped up) to exactly N. The
+// error is not carried across pixels outside of `mask`.
+std::vector<Vector2> errorDiffusionSampling(std::size_t N,
+                                            const DensityMap& density,
+                                            Random& random,
+                                            const DomainMask* mask = nullptr);
+
+// Samples the darkness band by band: a first pass measures the mass of every
+// band of `bandRows` rows, a second one draws each band's share of N from its
+// CDF. Only a single band is resident at any time.
+std::vector<Vector2> streamingSampling(std::size_t N, DensityBandReader& reader,
+                                       std::size_t bandRows, Random& random);
+
+// Warps the R2 low-discrepancy sequence through the density described by the
+// prefix function: first the row marginal, then the CDF within that row.
+std::vector<Vector2> lowDiscrepancySampling(std::size_t N,
+                                            const PrefixFunction& P);
+
+// The flood fill never enters pixels outside of `mask`, when given; their
+// label is meaningless. The pixels of a part of the mask without a generator
+// are labelled generators.size(). With the same mask as the last step on
+// `scratch`, only the pixels inside are reset. Labels into `scratch.labels`.
+void getVoronoiDiagram(Vector2 dimensions, std::vector<Vector2>& generators,
+                       VoronoiScratch& scratch,
+                       const DomainMask* mask = nullptr);
+Grid<std::size_t> getVoronoiDiagram(Vector2 dimensions,
+                                    std::vector<Vector2>& generators,
+                                    const DomainMask* mask = nullptr);
+
+// Row spans of every voronoi cell (within `mask`, when given, and without
+// the pixels no generator reaches), the cell
+// boundaries are drawn onto `boundaryImage` when one is given. Into
+// `scratch.boundaries`.
+void getVoronoiBoundaries(Vector2 dimensions, std::vector<Vector2>& generators,
+                          VoronoiScratch& scratch,
+                          Image* boundaryImage = nullptr,
+                          const DomainMask* mask = nullptr);
 std::vector<VoronoiBoundary> getVoronoiBoundaries(
-    Image& img, std::vector<Vector2>& generators, bool drawBoundaries = false);
+    Vector2 dimensions, std::vector<Vector2>& generators,
+    Image* boundaryImage = nullptr, const DomainMask* mask = nullptr);
 
+// Same as getVoronoiBoundaries, but every pixel (inside `mask`, when given)
+// is labelled with its nearest generator, the lowest index on ties, as the
+// tiled engine does: bands of rows are labelled on `threads` threads, with
+// the same labels on any number of them. Unlike the flood fill, a part of
+// the mask without a generator joins the cells of the nearest ones.
+void getNearestBoundaries(Vector2 dimensions,
+                          const std::vector<Vector2>& generators,
+                          VoronoiScratch& scratch,
+                          const DomainMask* mask = nullptr,
+                          unsigned threads = 1);
+
+// The centroids of the cells that have any mass, in the order of the cells;
+// blocks of cells are computed on `threads` threads, with the same result.
 std::vector<Vector2> computeVoronoiCenters(
     std::vector<VoronoiBoundary>& boundaries,
-    std::pair<PrefixFunction, PrefixFunction> prefixFunctions);
+    const std::pair<PrefixFunction, PrefixFunction>& prefixFunctions,
+    unsigned threads = 1);
+
+// One relaxation step over an out-of-core density, streamed tile by tile:
+// every pixel is labelled with its nearest generator (looked up in a bucket
+// grid, there is no global flood fill) and accumulated straight into the
+// centroid of that generator, so neither labels nor prefix functions are
+// ever stored. Only the pixels inside `mask` are visited, when given.
+std::vector<Vector2> computeTiledVoronoiCenters(
+    TiledDensity& density, const std::vector<Vector2>& generators,
+    const DomainMask* mask = nullptr);
 
 #endif  // STIPPLING_VORONOI_
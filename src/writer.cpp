@@ -0,0 +1,85 @@
+#include "writer.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+
+BufferedWriter::BufferedWriter(const std::string filename,
+                               std::size_t capacity)
+    : buffer(capacity) {
+    fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw "Could not open file for writing.\n";
+}
+
+BufferedWriter::~BufferedWriter() {
+    if (fd < 0) return;
+    try {
+        close();
+    } catch (...) {
+    }
+}
+
+void BufferedWriter::write(const void* data, std::size_t size) {
+    const char* bytes = (const char*)data;
+    if (size >= buffer.size()) {
+        flush();
+        while (size) {
+            ssize_t n = ::write(fd, bytes, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw "Could not write to file.\n";
+            bytes += n;
+            size -= n;
+            flushed += n;
+        }
+        return;
+    }
+    std::memcpy(claim(size), bytes, size);
+}
+
+void BufferedWriter::write(const char* text) { write(text, std::strlen(text)); }
+
+void BufferedWriter::writeNumber(double value, int precision) {
+    constexpr std::size_t MAX_LENGTH = 32;
+    char* out = claim(MAX_LENGTH);
+    auto [end, error] = std::to_chars(out, out + MAX_LENGTH, value,
+                                      std::chars_format::fixed, precision);
+    if (error != std::errc()) {
+        // only absurdly large values do not fit, they are clamped to 0.
+        end = out;
+        *end++ = '0';
+    } else if (precision > 0) {
+        while (end[-1] == '0') --end;
+        if (end[-1] == '.') --end;
+    }
+    used -= (out + MAX_LENGTH) - end;
+}
+
+void BufferedWriter::writeInteger(long long value) {
+    constexpr std::size_t MAX_LENGTH = 24;
+    char* out = claim(MAX_LENGTH);
+    char* end = std::to_chars(out, out + MAX_LENGTH, value).ptr;
+    used -= (out + MAX_LENGTH) - end;
+}
+
+void BufferedWriter::flush() {
+    std::size_t written = 0;
+    while (written < used) {
+        ssize_t n = ::write(fd, buffer.data() + written, used - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw "Could not write to file.\n";
+        written += n;
+    }
+    flushed += used;
+    used = 0;
+}
+
+void BufferedWriter::close() {
+    if (fd < 0) return;
+    flush();
+    int result = ::close(fd);
+    fd = -1;
+    if (result != 0) throw "Could not close file.\n";
+}
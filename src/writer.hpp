@@ -0,0 +1,52 @@
+#ifndef STIPPLING_WRITER_
+#define STIPPLING_WRITER_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Write-only file with a large user-space buffer, so that producers can emit
+// many tiny pieces without a syscall (or an iostream) per piece.
+class BufferedWriter {
+   private:
+    int fd;
+    std::vector<char> buffer;
+    std::size_t used = 0, flushed = 0;
+
+   public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 1 << 20;
+
+    BufferedWriter(const std::string filename,
+                   std::size_t capacity = DEFAULT_CAPACITY);
+    ~BufferedWriter();
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    // Returns a pointer to `size` writable bytes inside the buffer; `size`
+    // must not exceed the capacity.
+    char* claim(std::size_t size) {
+        if (used + size > buffer.size()) flush();
+        char* out = buffer.data() + used;
+        used += size;
+        return out;
+    }
+
+    void put(char c) { *claim(1) = c; }
+    void write(const void* data, std::size_t size);
+    void write(const std::string& text) { write(text.data(), text.size()); }
+    void write(const char* text);
+
+    // Fixed notation with at most `precision` decimals, trailing zeros (and
+    // a trailing dot) are dropped.
+    void writeNumber(double value, int precision = 2);
+    void writeInteger(long long value);
+
+    // Number of bytes written so far, including the ones still buffered.
+    std::size_t tell() const { return flushed + used; }
+
+    void flush();
+    void close();
+};
+
+#endif  // STIPPLING_WRITER_